@@ -0,0 +1,602 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Differential throughput benchmark of the C and Python targets.
+
+For share/test.fsm and each family of synthetic FSM in :mod:`synth`, build
+each target implementation and drive the same pseudo-random event stream
+through it, twice. The first run hashes the sequence of callbacks called, and
+the FSM state when each is called, as share/test.c prints them: every target
+must have the same hash. The second run, with callbacks doing nothing, is
+timed, in nanoseconds per event including the driver loop.
+
+A condition is true depending on its number and the event `arg`, the number
+of the event in the stream. When a FSM reaches its final state, it is
+initialised again before the next event.
+
+With --counters, the C driver also counts hardware events with Linux
+perf_event_open: cycles, instructions, branch misses, L1 instruction and data
+cache read misses and instruction TLB read misses, in user space only. They are
+reported per event injected, first for the whole stream, then for each handler
+group, the handlers of one event: a group is counted by enabling the counters
+around each injection of its event only, less the cost of enabling and
+disabling them. A counter which the host does not support, or does not permit
+(see /proc/sys/kernel/perf_event_paranoid), is reported as "-".
+
+Exit with status 1 if any target's hash differs from the others, or, with
+--baseline, if any target is slower than the baseline by more than the
+tolerance.
+"""
+
+import importlib.util
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import sysconfig
+import tempfile
+
+from argparse import ArgumentParser
+from array import array
+from time import perf_counter_ns
+
+import rsk_fsm
+from rsk_fsm.build import FORMATS
+from rsk_fsm.compile import (SCHEMA_FILE, load_schema)
+from rsk_fsm.target.c import Builder as CBuilder
+from rsk_fsm.target.ir import Builder as IRBuilder
+from rsk_fsm.target.pythonc import Builder as PythonCBuilder
+
+import synth
+
+TEST_FSM = os.path.join(os.path.dirname(__file__), '..', 'share', 'test.fsm')
+
+### the FNV-1a 32-bit hash parameters
+FNV_OFFSET = 2166136261
+FNV_PRIME = 16777619
+MASK = 0xffffffff
+
+### the hardware counters of the C driver, in its order
+COUNTERS = (
+    'cycles', 'instructions', 'branch-misses',
+    'L1i-misses', 'L1d-misses', 'iTLB-misses',
+)
+
+### the C driver, for the implementation of FSM `prefix`
+C_DRIVER = '''\
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef COUNTERS
+#include <linux/perf_event.h>
+#include <math.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "{prefix}_fsm.h"
+
+static uint32_t hash = {offset}u;
+
+static void record(uint32_t ident, int state) {{
+	hash = (hash ^ ident) * {prime}u;
+	hash = (hash ^ (uint32_t) (state + 1)) * {prime}u;
+}}
+
+static int condition(uint32_t number, void * arg) {{
+	return ((*(int *) arg >> (number % 8)) ^ number) & 1;
+}}
+
+static void nop({prefix}_fsm_t * fsm, void * arg) {{
+	(void) fsm;
+	(void) arg;
+}}
+
+{callbacks}
+
+#ifdef DISPATCH
+#define INJECT(fsm, event, arg) {prefix}_fsm_dispatch(fsm, event, arg)
+#else
+static void (* const inject[])({prefix}_fsm_t *, void *) = {{
+{injectors}
+}};
+#define INJECT(fsm, event, arg) inject[event](fsm, arg)
+#endif
+
+static void run({prefix}_fsm_cb_t * cb, const uint16_t * events, size_t num) {{
+	{prefix}_fsm_t fsm;
+	int arg = 0;
+	{prefix}_fsm_init(&fsm, cb, NULL, &arg);
+	for (size_t idx = 0; idx < num; idx++) {{
+		arg = (int) idx;
+		if (fsm.state < 0) {{
+			{prefix}_fsm_init(&fsm, cb, NULL, &arg);
+		}}
+		INJECT(&fsm, events[idx], &arg);
+	}}
+}}
+
+#ifdef COUNTERS
+#define CACHE_MISS(cache) (PERF_COUNT_HW_CACHE_##cache \\
+	| (PERF_COUNT_HW_CACHE_OP_READ << 8) \\
+	| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {{
+	uint32_t type;
+	uint64_t config;
+}} counter_events[] = {{
+	{{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES}},
+	{{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS}},
+	{{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}},
+	{{PERF_TYPE_HW_CACHE, CACHE_MISS(L1I)}},
+	{{PERF_TYPE_HW_CACHE, CACHE_MISS(L1D)}},
+	{{PERF_TYPE_HW_CACHE, CACHE_MISS(ITLB)}},
+}};
+
+#define NUM_COUNTER (sizeof(counter_events) / sizeof(counter_events[0]))
+
+static int counter_fds[NUM_COUNTER];
+
+/* Open each counter disabled, or -1 if not available. */
+static void counters_open(void) {{
+	for (size_t idx = 0; idx < NUM_COUNTER; idx++) {{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counter_events[idx].type;
+		attr.config = counter_events[idx].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+			| PERF_FORMAT_TOTAL_TIME_RUNNING;
+		counter_fds[idx] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}}
+}}
+
+static void counters_reset(void) {{
+	for (size_t idx = 0; idx < NUM_COUNTER; idx++) {{
+		if (counter_fds[idx] >= 0) {{
+			ioctl(counter_fds[idx], PERF_EVENT_IOC_RESET, 0);
+		}}
+	}}
+}}
+
+/* Read each counter into `values`, scaled if multiplexed, or NAN. */
+static void counters_read(double * values) {{
+	for (size_t idx = 0; idx < NUM_COUNTER; idx++) {{
+		uint64_t data[3];
+		values[idx] = NAN;
+		if (counter_fds[idx] >= 0
+				&& read(counter_fds[idx], data, sizeof(data)) == sizeof(data)
+				&& data[2]) {{
+			values[idx] = (double) data[0] * data[1] / data[2];
+		}}
+	}}
+}}
+
+/* Print `values` less `overhead` per `count`, each per `count`. */
+static void counters_print(
+		const char * group, const double * values, const double * overhead,
+		size_t count) {{
+	printf("%s %zu", group, count);
+	for (size_t idx = 0; idx < NUM_COUNTER; idx++) {{
+		double value = values[idx] - (overhead ? overhead[idx] * count : 0);
+		if (isnan(value) || !count) {{
+			printf(" -");
+		}} else {{
+			printf(" %.3f", (value > 0 ? value : 0) / count);
+		}}
+	}}
+	printf("\\n");
+}}
+
+/* Count the injections of event `group` only. */
+static void count_run(
+		{prefix}_fsm_cb_t * cb, const uint16_t * events, size_t num,
+		int group) {{
+	{prefix}_fsm_t fsm;
+	int arg = 0;
+	{prefix}_fsm_init(&fsm, cb, NULL, &arg);
+	for (size_t idx = 0; idx < num; idx++) {{
+		arg = (int) idx;
+		if (fsm.state < 0) {{
+			{prefix}_fsm_init(&fsm, cb, NULL, &arg);
+		}}
+		if (events[idx] == group) {{
+			prctl(PR_TASK_PERF_EVENTS_ENABLE);
+			INJECT(&fsm, events[idx], &arg);
+			prctl(PR_TASK_PERF_EVENTS_DISABLE);
+		}} else {{
+			INJECT(&fsm, events[idx], &arg);
+		}}
+	}}
+}}
+
+/* Print the counters for the whole stream, then for each handler group. */
+static void count(const uint16_t * events, size_t num) {{
+	double values[NUM_COUNTER];
+	double overhead[NUM_COUNTER];
+	char group[16];
+	counters_open();
+	counters_reset();
+	prctl(PR_TASK_PERF_EVENTS_ENABLE);
+	run(&time_cb, events, num);
+	prctl(PR_TASK_PERF_EVENTS_DISABLE);
+	counters_read(values);
+	counters_print("all", values, NULL, num);
+	/* the cost counted of enabling and disabling the counters */
+	counters_reset();
+	for (size_t idx = 0; idx < num; idx++) {{
+		prctl(PR_TASK_PERF_EVENTS_ENABLE);
+		prctl(PR_TASK_PERF_EVENTS_DISABLE);
+	}}
+	counters_read(overhead);
+	for (size_t idx = 0; idx < NUM_COUNTER; idx++) {{
+		overhead[idx] /= num;
+	}}
+	for (int event = 0; event < {num_events}; event++) {{
+		size_t injected = 0;
+		for (size_t idx = 0; idx < num; idx++) {{
+			injected += events[idx] == event;
+		}}
+		counters_reset();
+		count_run(&time_cb, events, num, event);
+		counters_read(values);
+		snprintf(group, sizeof(group), "%d", event);
+		counters_print(group, values, overhead, injected);
+	}}
+}}
+#endif
+
+int main(int argc, char ** argv) {{
+	FILE * fid = argc == 2 ? fopen(argv[1], "rb") : NULL;
+	if (!fid) {{
+		return 1;
+	}}
+	fseek(fid, 0, SEEK_END);
+	size_t num = (size_t) ftell(fid) / sizeof(uint16_t);
+	rewind(fid);
+	uint16_t * events = malloc(num * sizeof(uint16_t));
+	if (!events || fread(events, sizeof(uint16_t), num, fid) != num) {{
+		return 1;
+	}}
+	fclose(fid);
+	run(&trace_cb, events, num);
+	double best = 0;
+	for (int repeat = 0; repeat < {repeat}; repeat++) {{
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		run(&time_cb, events, num);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double ns = (end.tv_sec - start.tv_sec) * 1e9
+			+ (end.tv_nsec - start.tv_nsec);
+		if (!repeat || ns < best) {{
+			best = ns;
+		}}
+	}}
+	printf("%08x %.2f\\n", hash, best / num);
+#ifdef COUNTERS
+	count(events, num);
+#endif
+	free(events);
+	return 0;
+}}
+'''
+
+def _c_callbacks(prefix, ir):
+    """Return the C source of the driver callbacks for `ir`."""
+    lines = []
+    trace = []
+    time = []
+    for (number, condition) in enumerate(ir['conditions']):
+        ident = len(ir['actions']) + number
+        lines.extend([
+            f'static int trace_condition_{number}'
+            f'({prefix}_fsm_t * fsm, void * arg) {{',
+            f'\tint result = condition({number}, arg);',
+            f'\trecord({ident}, fsm->state);',
+            '\treturn result;',
+            '}',
+            f'static int time_condition_{number}'
+            f'({prefix}_fsm_t * fsm, void * arg) {{',
+            '\t(void) fsm;',
+            f'\treturn condition({number}, arg);',
+            '}',
+        ])
+        trace.append(f'\t.condition_{condition} = trace_condition_{number},')
+        time.append(f'\t.condition_{condition} = time_condition_{number},')
+    for (number, action) in enumerate(ir['actions']):
+        lines.extend([
+            f'static void trace_action_{number}'
+            f'({prefix}_fsm_t * fsm, void * arg) {{',
+            '\t(void) arg;',
+            f'\trecord({number}, fsm->state);',
+            '}',
+        ])
+        trace.append(f'\t.action_{action} = trace_action_{number},')
+        time.append(f'\t.action_{action} = nop,')
+    return '\n'.join(
+        lines
+        + [f'static {prefix}_fsm_cb_t trace_cb = {{'] + trace + ['};']
+        + [f'static {prefix}_fsm_cb_t time_cb = {{'] + time + ['};']
+    )
+
+def _python_callbacks(ir, trace):
+    """Return (callbacks, hash getter) for `ir`, tracing if `trace`."""
+    state = [FNV_OFFSET]
+    def record(ident, fsm):
+        value = -1 if fsm.state is None else fsm.state
+        hashed = ((state[0] ^ ident) * FNV_PRIME) & MASK
+        state[0] = ((hashed ^ ((value + 1) & MASK)) * FNV_PRIME) & MASK
+    def condition(number):
+        if trace:
+            ident = len(ir['actions']) + number
+            def callback(fsm, arg):
+                result = ((arg >> (number % 8)) ^ number) & 1
+                record(ident, fsm)
+                return result
+        else:
+            def callback(fsm, arg): # pylint: disable=unused-argument
+                return ((arg >> (number % 8)) ^ number) & 1
+        return callback
+    def action(number):
+        if trace:
+            return lambda fsm, arg: record(number, fsm)
+        return lambda fsm, arg: None
+    callbacks = type('Callbacks', (), {})()
+    for (number, name) in enumerate(ir['conditions']):
+        setattr(callbacks, f'condition_{name}', condition(number))
+    for (number, name) in enumerate(ir['actions']):
+        setattr(callbacks, f'action_{name}', action(number))
+    return (callbacks, lambda: state[0])
+
+def _python_run(module, ir, events, repeat):
+    """Return (hash, ns per event) of driving `events` through `module`."""
+    fsm_class = module.Fsm
+    injectors = [getattr(fsm_class, f'inject_{_}') for _ in ir['events']]
+    def run(callbacks):
+        fsm = fsm_class(callbacks, arg=0)
+        for (arg, event) in enumerate(events):
+            if fsm.state is None:
+                fsm = fsm_class(callbacks, arg=arg)
+            injectors[event](fsm, arg)
+    (callbacks, get_hash) = _python_callbacks(ir, True)
+    run(callbacks)
+    (callbacks, _) = _python_callbacks(ir, False)
+    best = None
+    for _ in range(repeat):
+        start = perf_counter_ns()
+        run(callbacks)
+        elapsed = perf_counter_ns() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return (f'{get_hash():08x}', best / len(events))
+
+class Bench():
+    """Build and run each target implementation in `directory`.
+
+    If `counters` then count hardware events in the C targets: :attr:`counts`
+    maps (FSM name, target) to a list of (handler group, injections, values
+    per injection), with None for a counter not available.
+    """
+    def __init__(self, directory, repeat, compiler, counters=False):
+        self._directory = directory
+        self._repeat = repeat
+        self._compiler = compiler
+        self._counters = counters
+        self.counts = {}
+    def _cc(self, *args):
+        """Run the C compiler with `args`."""
+        subprocess.run([self._compiler, '-O2'] + list(args), check=True)
+    def c_targets(self, fsm, ir, path):
+        """Yield (target, hash, ns per event) for the C target modes."""
+        prefix = ir['name']
+        for (target, options, defines) in (
+                ('C', {}, []),
+                ('C dispatch', {'dispatch': True}, ['-DDISPATCH']),
+            ):
+            build = tempfile.mkdtemp(dir=self._directory)
+            CBuilder(prefix, **options).build(fsm).write_files(build)
+            driver = os.path.join(build, 'driver.c')
+            with open(driver, 'w', encoding='utf-8') as fid:
+                fid.write(C_DRIVER.format(
+                    prefix=prefix,
+                    offset=FNV_OFFSET,
+                    prime=FNV_PRIME,
+                    repeat=self._repeat,
+                    num_events=len(ir['events']),
+                    callbacks=_c_callbacks(prefix, ir),
+                    injectors='\n'.join(
+                        f'\t{prefix}_fsm_inject_{_},' for _ in ir['events']
+                    ),
+                ))
+            binary = os.path.join(build, 'driver')
+            if self._counters:
+                defines = defines + ['-DCOUNTERS']
+            self._cc(
+                *defines, '-o', binary,
+                driver, os.path.join(build, f'{prefix}_fsm.c'),
+            )
+            (line, *lines) = subprocess.run(
+                [binary, path], check=True, capture_output=True, text=True,
+            ).stdout.splitlines()
+            if self._counters:
+                self.counts[(prefix, target)] = [
+                    _counts(ir, _.split()) for _ in lines
+                ]
+            (hashed, nanos) = line.split()
+            yield (target, hashed, float(nanos))
+    def python_targets(self, spec, fsm, ir, events):
+        """Yield (target, hash, ns per event) for the Python target modes."""
+        for (target, options) in (
+                ('Python', {}),
+                ('Python match', {'match': True}),
+            ):
+            module = rsk_fsm.load(spec, **options)
+            yield (target, *_python_run(module, ir, events, self._repeat))
+        if self._compiler:
+            module = self._pythonc(fsm, ir['name'])
+            yield ('PythonC', *_python_run(module, ir, events, self._repeat))
+    def _pythonc(self, fsm, prefix):
+        """Return the CPython extension module for `fsm`."""
+        build = tempfile.mkdtemp(dir=self._directory)
+        names = PythonCBuilder(prefix).build(fsm).write_files(build)
+        name = f'{prefix}_fsm'
+        path = os.path.join(
+            build, name + sysconfig.get_config_var('EXT_SUFFIX'),
+        )
+        self._cc(
+            '-shared', '-fPIC', '-I' + sysconfig.get_paths()['include'],
+            '-o', path, *[os.path.join(build, _) for _ in names],
+        )
+        module_spec = importlib.util.spec_from_file_location(name, path)
+        module = importlib.util.module_from_spec(module_spec)
+        module_spec.loader.exec_module(module)
+        return module
+
+def _counts(ir, fields):
+    """Return (handler group, injections, values) of C driver output `fields`.
+    """
+    (group, injected, *values) = fields
+    if group != 'all':
+        group = ir['events'][int(group)]
+    return (group, int(injected), [
+        None if _ == '-' else float(_) for _ in values
+    ])
+
+def _print_counts(counts):
+    """Print the table of hardware counters per injection in `counts`."""
+    if all(
+            _ is None
+            for rows in counts.values() for (_, __, values) in rows
+            for _ in values
+        ):
+        print(
+            'hardware counters are not available on this host',
+            file=sys.stderr,
+        )
+    print()
+    print(
+        f'{"fsm":<10}{"target":<14}{"group":<10}{"events":>8}'
+        + ''.join(f'{_:>15}' for _ in COUNTERS)
+    )
+    for ((name, target), rows) in counts.items():
+        for (group, injected, values) in rows:
+            print(
+                f'{name:<10}{target:<14}{group:<10}{injected:>8}'
+                + ''.join(
+                    f'{"-":>15}' if _ is None else f'{_:>15.2f}'
+                    for _ in values
+                )
+            )
+
+def _specs(names):
+    """Yield (name, spec JSON text) for each FSM benchmarked."""
+    if not names or 'test' in names:
+        with open(TEST_FSM, encoding='utf-8') as fid:
+            yield ('test', fid.read())
+    for (family, params) in synth.FAMILIES.items():
+        if not names or family in names:
+            yield (family, json.dumps(synth.generate(family, **params)))
+
+def main():
+    """Run the differential benchmark."""
+    aparser = ArgumentParser(description=__doc__.split('\n\n', 1)[0])
+    aparser.add_argument(
+        '-n', '--events', type=int, default=100000,
+        help="the number of events in each stream (default: 100000)",
+    )
+    aparser.add_argument(
+        '--seed', type=int, default=0,
+        help="the seed of the event streams (default: 0)",
+    )
+    aparser.add_argument(
+        '--repeat', type=int, default=3,
+        help="time the best of this many runs (default: 3)",
+    )
+    aparser.add_argument(
+        '--cc', default=os.environ.get('CC', 'cc'),
+        help="the C compiler (default: $CC or cc); C targets are skipped"
+        " if it is not found",
+    )
+    aparser.add_argument(
+        '--json', metavar='FILE',
+        help="write the ns/event of each FSM and target to FILE",
+    )
+    aparser.add_argument(
+        '--baseline', metavar='FILE',
+        help="compare with the ns/event in FILE, written by --json",
+    )
+    aparser.add_argument(
+        '--tolerance', type=float, default=0.25,
+        help="the fraction slower than the baseline which is a regression"
+        " (default: 0.25)",
+    )
+    aparser.add_argument(
+        '--counters', action='store_true',
+        help="count hardware events in the C targets, per event injected"
+        " and per handler group (Linux only)",
+    )
+    aparser.add_argument(
+        'fsm', nargs='*',
+        help="the FSMs to benchmark: test, or a family of synthetic FSM"
+        f" ({', '.join(synth.FAMILIES)}) (default: all)",
+    )
+    args = aparser.parse_args()
+    compiler = shutil.which(args.cc)
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline, encoding='utf-8') as fid:
+            baseline = json.load(fid)
+    schema = load_schema(SCHEMA_FILE, dict(FORMATS))
+    results = {}
+    failed = False
+    print(f'{"fsm":<10}{"target":<14}{"ns/event":>10}  {"hash":<10}status')
+    with tempfile.TemporaryDirectory() as directory:
+        bench = Bench(directory, args.repeat, compiler, args.counters)
+        for (name, spec) in _specs(args.fsm):
+            fsm = schema.decode(spec)
+            ir = IRBuilder(fsm['name']).build(fsm).ir
+            rng = random.Random(args.seed)
+            events = array('H', (
+                rng.randrange(len(ir['events'])) for _ in range(args.events)
+            ))
+            path = os.path.join(directory, f'{name}.events')
+            with open(path, 'wb') as fid:
+                events.tofile(fid)
+            rows = list(bench.python_targets(spec, fsm, ir, events))
+            if compiler:
+                rows = list(bench.c_targets(fsm, ir, path)) + rows
+            reference = rows[0][1]
+            for (target, hashed, nanos) in rows:
+                key = f'{name}/{target}'
+                results[key] = nanos
+                status = 'ok'
+                if hashed != reference:
+                    status = 'DRIFT'
+                elif key in baseline and (
+                        nanos > baseline[key] * (1 + args.tolerance)
+                    ):
+                    status = f'SLOWER (baseline {baseline[key]:.1f})'
+                failed = failed or status != 'ok'
+                print(
+                    f'{name:<10}{target:<14}{nanos:>10.1f}'
+                    f'  {hashed:<10}{status}'
+                )
+        if bench.counts:
+            _print_counts(bench.counts)
+    if args.json:
+        with open(args.json, 'w', encoding='utf-8') as fid:
+            json.dump(results, fid, indent=4, sort_keys=True)
+            fid.write('\n')
+    if failed:
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
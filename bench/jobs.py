@@ -0,0 +1,86 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Benchmark building a FSM in worker processes.
+
+For each number of jobs, build and write the C and Python target
+implementations of a synthetic FSM generated with :mod:`synth`, check that
+each is byte-identical to the implementation built in this process, and
+report the best time of each and its speedup over one job.
+"""
+
+import json
+import os
+import tempfile
+
+from argparse import ArgumentParser
+from time import perf_counter
+
+from rsk_fsm.build import FORMATS
+from rsk_fsm.compile import (SCHEMA_FILE, load_schema)
+from rsk_fsm.target.c import Builder as CBuilder
+from rsk_fsm.target.python import Builder as PythonBuilder
+
+import synth
+
+TARGETS = {
+    'c': CBuilder,
+    'python': PythonBuilder,
+}
+
+def _build(builder, fsm, jobs):
+    """Return (seconds, files) of building and writing `fsm` in `jobs` jobs.
+
+    `files` is a mapping of file name to file content written.
+    """
+    with tempfile.TemporaryDirectory() as directory:
+        start = perf_counter()
+        names = builder('jobs', jobs=jobs).build(fsm).write_files(directory)
+        seconds = perf_counter() - start
+        files = {}
+        for name in names:
+            with open(os.path.join(directory, name), encoding='utf-8') as fid:
+                files[name] = fid.read()
+    return (seconds, files)
+
+def main():
+    """Run the jobs benchmark."""
+    aparser = ArgumentParser(description=__doc__.split('\n\n', 1)[0])
+    aparser.add_argument(
+        'jobs', nargs='*', type=int, default=[1, 2, 4],
+        help="the numbers of jobs (default: 1 2 4)",
+    )
+    aparser.add_argument(
+        '--states', type=int, default=5000,
+        help="the number of states (default: 5000)",
+    )
+    aparser.add_argument(
+        '--family', choices=tuple(synth.FAMILIES), default='sparse',
+        help="the shape of the FSM, other than its number of states"
+        " (default: sparse)",
+    )
+    aparser.add_argument(
+        '--repeat', type=int, default=3,
+        help="report the best of this many builds (default: 3)",
+    )
+    args = aparser.parse_args()
+    schema = load_schema(SCHEMA_FILE, dict(FORMATS))
+    params = dict(synth.FAMILIES[args.family], states=args.states)
+    fsm = schema.decode(json.dumps(synth.generate('jobs', **params)))
+    print(f'{args.family} FSM of {args.states} states,'
+          f' {len(os.sched_getaffinity(0))} CPUs available')
+    print(f'{"target":<8}{"jobs":>6}{"build s":>10}{"speedup":>10}')
+    for (target, builder) in TARGETS.items():
+        (serial, expected) = _build(builder, fsm, 1)
+        for jobs in args.jobs:
+            best = None
+            for _ in range(args.repeat):
+                (seconds, files) = _build(builder, fsm, jobs)
+                if files != expected:
+                    raise SystemExit(f'{target} with {jobs} jobs differs')
+                best = seconds if best is None else min(best, seconds)
+            if jobs == 1:
+                serial = best
+            print(f'{target:<8}{jobs:>6}{best:>10.3f}{serial / best:>10.2f}')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,70 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Compare the Python target dispatch styles on share/test.fsm.
+
+Time injecting an event into a Python implementation of the test FSM built
+with handler tables (the default) and with a match dispatcher (--match), in
+nanoseconds per event. Callbacks do nothing and every condition is true.
+"""
+
+import os
+
+from timeit import Timer
+
+import rsk_fsm
+
+TEST_FSM = os.path.join(os.path.dirname(__file__), '..', 'share', 'test.fsm')
+
+### the number of events injected in each timing
+NUMBER = 200000
+
+def _callbacks(module):
+    """Return callbacks for the FSM in `module`, doing nothing."""
+    attrs = {}
+    for name in dir(module.Callbacks):
+        if name.startswith('condition_'):
+            attrs[name] = staticmethod(lambda fsm, arg: True)
+        elif name.startswith('action_'):
+            attrs[name] = staticmethod(lambda fsm, arg: None)
+    return type('Callbacks', (module.Callbacks,), attrs)()
+
+def _scenarios(module):
+    """Return a list of (scenario, FSM instance, event) to time."""
+    fsm = module.Fsm(_callbacks(module))
+    handled = module.Fsm(_callbacks(module))
+    handled.inject_Z() # into /D/E, where X toggles between /D/E and /D/F
+    unhandled = module.Fsm(_callbacks(module))
+    unhandled.inject_Z()
+    return [
+        ('X in /A (first cases)', fsm, 'X'),
+        ('X in /D (later cases)', handled, 'X'),
+        ('Z in /D (unhandled)', unhandled, 'Z'),
+    ]
+
+def main():
+    """Print nanoseconds per event for each dispatch style and scenario."""
+    with open(TEST_FSM, encoding='utf-8') as fid:
+        spec = fid.read()
+    # (style, module, whether to call inject(event) not inject_<event>())
+    styles = (
+        ('tables', rsk_fsm.load(spec), False),
+        ('match', rsk_fsm.load(spec, match=True), False),
+        ('inject()', rsk_fsm.load(spec, match=True), True),
+    )
+    print(f'{"scenario":<24}' + ''.join(f'{_[0]:>10}' for _ in styles))
+    for idx in range(3):
+        row = []
+        for (_, module, direct) in styles:
+            (scenario, fsm, event) = _scenarios(module)[idx]
+            if direct:
+                timer = Timer('inject(event)', globals={
+                    'inject': fsm.inject, 'event': event,
+                })
+            else:
+                timer = Timer(getattr(fsm, f'inject_{event}'))
+            best = min(timer.repeat(5, NUMBER))
+            row.append(f'{best / NUMBER * 1e9:>10.1f}')
+        print(f'{scenario:<24}' + ''.join(row))
+
+if __name__ == '__main__':
+    main()
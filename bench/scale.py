@@ -0,0 +1,129 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Benchmark how building a FSM scales with its size.
+
+For each number of states, generate a synthetic FSM with :mod:`synth`, then
+report the time to decode it, the time and peak (Python) memory of building
+and writing its C target implementation, the size of the C source, and the
+time, maximum resident memory and object size of compiling the C source. The
+peak memory is measured in a separate build, tracing memory allocations in
+this process only, so that tracing does not add to the build time.
+"""
+
+import json
+import os
+import resource
+import shutil
+import subprocess
+import tempfile
+import tracemalloc
+
+from argparse import ArgumentParser
+from time import perf_counter
+
+from rsk_fsm.build import FORMATS
+from rsk_fsm.compile import (SCHEMA_FILE, load_schema)
+from rsk_fsm.target.c import Builder as CBuilder
+
+import synth
+
+COLUMNS = (
+    ('states', 8, 'd'),
+    ('decode s', 10, '.3f'),
+    ('build s', 10, '.3f'),
+    ('peak MiB', 10, '.1f'),
+    ('source KiB', 12, 'd'),
+    ('cc s', 10, '.3f'),
+    ('cc MiB', 10, '.1f'),
+    ('object KiB', 12, 'd'),
+)
+
+def _row(values):
+    """Return a table row of `values`, one for each column."""
+    return ''.join(
+        f'{value:>{width}{fmt}}' if value is not None else f'{"-":>{width}}'
+        for ((_, width, fmt), value) in zip(COLUMNS, values)
+    )
+
+def _cc(compiler, source):
+    """Return (seconds, max RSS MiB, object KiB) of compiling `source`."""
+    obj = source[:-2] + '.o'
+    start = perf_counter()
+    # the max RSS of children is of the largest child yet: fork a child to
+    # measure each compilation alone
+    pid = os.fork()
+    if not pid:
+        try:
+            os.execvp(compiler, [compiler, '-O2', '-c', '-o', obj, source])
+        finally:
+            os._exit(127) # pylint: disable=protected-access
+    (_, status, usage) = os.wait4(pid, 0)
+    seconds = perf_counter() - start
+    code = os.waitstatus_to_exitcode(status)
+    if code:
+        raise subprocess.CalledProcessError(code, compiler)
+    return (seconds, usage.ru_maxrss / 1024, os.path.getsize(obj) // 1024)
+
+def _build(fsm, jobs, directory):
+    """Return the names of the files of `fsm` built and written in `directory`.
+    """
+    return CBuilder('scale', jobs=jobs).build(fsm).write_files(directory)
+
+def _peak(fsm, jobs):
+    """Return the peak MiB traced building and writing `fsm`."""
+    with tempfile.TemporaryDirectory() as directory:
+        tracemalloc.start()
+        try:
+            _build(fsm, jobs, directory)
+            peak = tracemalloc.get_traced_memory()[1]
+        finally:
+            tracemalloc.stop()
+    return peak / 2 ** 20
+
+def main():
+    """Run the scale benchmark."""
+    aparser = ArgumentParser(description=__doc__.split('\n\n', 1)[0])
+    aparser.add_argument(
+        'sizes', nargs='*', type=int, default=[100, 1000, 10000],
+        help="the numbers of states (default: 100 1000 10000)",
+    )
+    aparser.add_argument(
+        '--family', choices=tuple(synth.FAMILIES), default='sparse',
+        help="the shape of each FSM, other than its number of states"
+        " (default: sparse)",
+    )
+    aparser.add_argument(
+        '-j', '--jobs', type=int, default=1, metavar='N',
+        help="build in N worker processes (default: 1)",
+    )
+    aparser.add_argument(
+        '--cc', default=os.environ.get('CC', 'cc'),
+        help="the C compiler (default: $CC or cc); compiling is skipped if"
+        " it is not found",
+    )
+    args = aparser.parse_args()
+    compiler = shutil.which(args.cc)
+    schema = load_schema(SCHEMA_FILE, dict(FORMATS))
+    print(''.join(f'{name:>{width}}' for (name, width, _) in COLUMNS))
+    for states in args.sizes:
+        params = dict(synth.FAMILIES[args.family], states=states)
+        spec = json.dumps(synth.generate('scale', **params))
+        start = perf_counter()
+        fsm = schema.decode(spec)
+        decode = perf_counter() - start
+        with tempfile.TemporaryDirectory() as directory:
+            start = perf_counter()
+            names = _build(fsm, args.jobs, directory)
+            build = perf_counter() - start
+            source = os.path.join(directory, 'scale_fsm.c')
+            size = sum(
+                os.path.getsize(os.path.join(directory, _)) for _ in names
+            ) // 1024
+            cc = _cc(compiler, source) if compiler else (None,) * 3
+        peak = _peak(fsm, args.jobs)
+        print(_row((states, decode, build, peak, size) + cc))
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024
+    print(f'max RSS of this process: {rss:.1f} MiB')
+
+if __name__ == '__main__':
+    main()
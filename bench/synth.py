@@ -0,0 +1,187 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Generate synthetic FSM specifications for benchmarks.
+
+:func:`generate` returns a pseudo-random FSM specification, a JSON value, of
+a given shape. :data:`FAMILIES` are the shapes used by the benchmarks. Run as
+a script to write a FSM specification to stdout, e.g.::
+
+    python3 bench/synth.py --states 100000 --depth 6 --fanout 16 big >big.fsm
+"""
+
+import json
+import random
+import sys
+
+from argparse import ArgumentParser
+
+### parameters of :func:`generate` for each family of synthetic FSM
+FAMILIES = {
+    # long exit and enter chains
+    'deep': {
+        'states': 64, 'depth': 16, 'fanout': 2,
+        'events': 4, 'events_per_state': 1, 'guards': 0.0,
+    },
+    # many flat states, each handling most events
+    'wide': {
+        'states': 512, 'depth': 1, 'fanout': 1,
+        'events': 8, 'events_per_state': 6, 'guards': 0.0,
+    },
+    # many events, each handled in few states
+    'sparse': {
+        'states': 128, 'depth': 2, 'fanout': 8,
+        'events': 64, 'events_per_state': 1, 'guards': 0.0,
+    },
+    # most transitions guarded by conditions
+    'guarded': {
+        'states': 32, 'depth': 2, 'fanout': 4,
+        'events': 4, 'events_per_state': 3, 'guards': 0.75,
+    },
+}
+
+def name(prefix, number):
+    """Return a name, `prefix` followed by `number` in letters.
+
+    FSM names may not contain digits.
+    """
+    letters = ''
+    while True:
+        (number, digit) = divmod(number, 26)
+        letters = chr(ord('a') + digit) + letters
+        if not number:
+            return prefix + letters
+
+def relative(context, pointer):
+    """Return a relative state pointer from state `context` to `pointer`.
+
+    `context` and `pointer` are absolute state pointers.
+    """
+    context = context.split('/')[1:]
+    target = pointer.split('/')[1:]
+    common = 0
+    while common < min(len(context), len(target)) and (
+            context[common] == target[common]
+        ):
+        common += 1
+    return '.' + '/..' * (len(context) - common) + ''.join(
+        '/' + _ for _ in target[common:]
+    )
+
+def generate( # pylint: disable=too-many-arguments,too-many-locals
+        fsm_name, states, depth, fanout, events, events_per_state, guards,
+        relatives=0.0, seed=0,
+    ):
+    """Return a synthetic FSM specification named `fsm_name`.
+
+    The FSM has `states` states, nested at most `depth` deep, each composite
+    state having at most `fanout` substates. There are `events` events, each
+    state handling `events_per_state` of them. `guards` is the fraction of
+    handled events with transitions guarded by conditions, and `relatives`
+    the fraction of next states given by relative, not absolute, state
+    pointers. Each state has an enter or exit action with probability one
+    half, and each transition has zero to two actions. The FSM is
+    pseudo-random, the same for each `seed`.
+    """
+    rng = random.Random(seed)
+    # (spec, absolute pointer, depth) for each state, created depth first
+    nodes = []
+    top = []
+    candidates = []
+    for idx in range(states):
+        spec = {'state': name('S', idx)}
+        if candidates:
+            (parent, pointer, level) = candidates[-1]
+            parent.setdefault('states', []).append(spec)
+            parent.setdefault('initial', spec['state'])
+            node = (spec, f'{pointer}/{spec["state"]}', level + 1)
+            if len(parent['states']) == fanout:
+                candidates.pop()
+        else:
+            top.append(spec)
+            node = (spec, f'/{spec["state"]}', 1)
+        nodes.append(node)
+        if node[2] < depth:
+            candidates.append(node)
+    pointers = [pointer for (_, pointer, __) in nodes]
+    event_names = [name('E', _) for _ in range(events)]
+    actions = [name('a', _) for _ in range(max(4, states // 8))]
+    conditions = [name('c', _) for _ in range(max(2, events // 2))]
+    def transition(context, event, condition=None):
+        spec = {'event': event}
+        if condition:
+            spec['condition'] = condition
+        chosen = rng.sample(actions, rng.randrange(3))
+        if chosen:
+            spec['actions'] = chosen
+        # an internal transition has no next state
+        if rng.random() < 0.9:
+            pointer = rng.choice(pointers)
+            if relatives and rng.random() < relatives:
+                pointer = relative(context, pointer)
+            spec['next'] = pointer
+        return spec
+    for (spec, context, _) in nodes:
+        for kind in ('enter', 'exit'):
+            if rng.random() < 0.5:
+                spec[kind] = [rng.choice(actions)]
+        transitions = []
+        for event in rng.sample(event_names, min(events_per_state, events)):
+            if rng.random() < guards:
+                condition = rng.choice(conditions)
+                transitions.append(transition(context, event, condition))
+                if rng.random() < 0.5:
+                    transitions.append(
+                        transition(context, event, {'not': condition}),
+                    )
+                else:
+                    transitions.append(transition(context, event))
+            else:
+                transitions.append(transition(context, event))
+        if transitions:
+            spec['transitions'] = transitions
+    return {'name': fsm_name, 'initial': top[0]['state'], 'states': top}
+
+def main():
+    """Write a synthetic FSM specification to stdout."""
+    aparser = ArgumentParser(description=main.__doc__)
+    aparser.add_argument(
+        '--family', choices=tuple(FAMILIES),
+        help="default the other options to those of this family",
+    )
+    defaults = {
+        'states': 1000, 'depth': 4, 'fanout': 8,
+        'events': 16, 'events_per_state': 2, 'guards': 0.25,
+    }
+    for (option, kind, help_) in (
+            ('states', int, "the number of states"),
+            ('depth', int, "the maximum depth of nesting, 1 for none"),
+            ('fanout', int, "the maximum number of substates of a state"),
+            ('events', int, "the number of events"),
+            ('events_per_state', int, "the number of events each state"
+             " handles"),
+            ('guards', float, "the fraction of handled events with guarded"
+             " transitions"),
+            ('relatives', float, "the fraction of next states given by"
+             " relative state pointers"),
+        ):
+        aparser.add_argument(
+            '--' + option.replace('_', '-'), type=kind,
+            help=f"{help_} (default: {defaults.get(option, 0)})",
+        )
+    aparser.add_argument(
+        '--seed', type=int, default=0,
+        help="the pseudo-random seed (default: 0)",
+    )
+    aparser.add_argument('name', help="the name of the FSM")
+    args = aparser.parse_args()
+    params = dict(defaults, relatives=0.0)
+    if args.family:
+        params.update(FAMILIES[args.family])
+    for option in params:
+        if getattr(args, option) is not None:
+            params[option] = getattr(args, option)
+    json.dump(generate(args.name, seed=args.seed, **params), sys.stdout)
+    sys.stdout.write('\n')
+
+if __name__ == '__main__':
+    main()
@@ -17,15 +17,65 @@ python3 -m rsk_fsm.compile "$FSM" Python >"test_fsm.py"
 
 OUT=test_fsm.out
 SOURCE=test_fsm.c
-HEADER=test_fsm.h
 MAIN=test.c
 BIN=test-fsm
 
 python3 -m rsk_fsm.compile "$FSM" C >"$OUT"
-cat "$OUT" | awk "$(printf '{print >out}; /\/\* EOF \*\//{out="%s"}' "$SOURCE")" out="$HEADER" -
-INCLUDE="$(printf '#include "%s"' "$HEADER")"
-sed -i "1i $INCLUDE\n" "$SOURCE"
+python3 -m rsk_fsm.compile "$FSM" C --output-dir .
 gcc -o "$BIN" "$MAIN" "$SOURCE"
 echo "./$BIN" "$@"
 "./$BIN" "$@"
 rm "$BIN"
+
+### C executor runtime
+
+RUNTIME="$(python3 -m rsk_fsm.runtime)"
+EXECUTOR=test_executor.c
+BUILD="$(mktemp -d)"
+
+python3 -m rsk_fsm.compile "$FSM" C --mailbox 64 --dispatch --output-dir "$BUILD"
+cp "$EXECUTOR" "$BUILD"
+gcc -pthread -I"$RUNTIME" -o "$BUILD/$BIN" "$BUILD/$EXECUTOR" "$BUILD/$SOURCE" "$RUNTIME/rsk_fsm_executor.c"
+"$BUILD/$BIN"
+rm -r "$BUILD"
+
+### C replay runtime
+
+LOG=test_fsm.log
+BUILD="$(mktemp -d)"
+
+python3 -m rsk_fsm.compile "$FSM" C --replay --output-dir "$BUILD"
+python3 -c '
+import struct, sys
+with open(sys.argv[1], "wb") as fid:
+    for time in range(1000):
+        fid.write(struct.pack("=QIHH", time, time % 7, time % 3, 0))
+' "$BUILD/$LOG"
+gcc -std=c11 -pthread -I"$RUNTIME" -o "$BUILD/$BIN" "$BUILD/test_fsm_replay.c" "$BUILD/$SOURCE" "$RUNTIME/rsk_fsm_replay.c"
+diff <("$BUILD/$BIN" "$BUILD/$LOG" | sed 1,4d) <("$BUILD/$BIN" "$BUILD/$LOG" 4 2 | sed 1,4d)
+rm -r "$BUILD"
+
+### Python match dispatcher
+
+SCRIPT=test_python.py
+BUILD="$(mktemp -d)"
+
+python3 -m rsk_fsm.compile "$FSM" Python --match --output-dir "$BUILD"
+cp "$SCRIPT" "$BUILD"
+diff <(python3 "$SCRIPT" "$@") <(python3 "$BUILD/$SCRIPT" "$@")
+rm -r "$BUILD"
+
+### CPython extension
+
+SCRIPT=test_python.py
+BUILD="$(mktemp -d)"
+
+python3 -m rsk_fsm.compile "$FSM" PythonC --output-dir "$BUILD"
+gcc -shared -fPIC $(python3-config --includes) -o "$BUILD/test_fsm$(python3-config --extension-suffix)" "$BUILD/$SOURCE" "$BUILD/test_fsm_module.c"
+cp "$SCRIPT" "$BUILD"
+diff <(python3 "$SCRIPT" "$@") <(python3 "$BUILD/$SCRIPT" "$@")
+rm -r "$BUILD"
+
+### Differential C and Python targets
+
+python3 ../bench/differential.py --events 5000 --repeat 1 test guarded >/dev/null
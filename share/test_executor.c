@@ -0,0 +1,90 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test_fsm.h"
+#include "rsk_fsm_executor.h"
+
+#define NUM_INSTANCES 64
+#define NUM_PRODUCERS 4
+#define NUM_POSTS 10000
+
+static int args[2] = {1, 2};
+
+static int test_condition_check(test_fsm_t * fsm, void * arg) {
+    return *(int *)arg > 1;
+}
+static void test_action(test_fsm_t * fsm, void * arg) {
+}
+
+static test_fsm_cb_t cb = {
+    test_condition_check,
+    test_action, test_action, test_action, test_action, test_action,
+    test_action, test_action, test_action, test_action, test_action,
+    test_action, test_action, test_action, test_action,
+};
+
+static rsk_fsm_executor_t executor;
+static test_fsm_t fsms[NUM_INSTANCES];
+static test_fsm_t references[NUM_INSTANCES];
+static rsk_fsm_actor_t actors[NUM_INSTANCES];
+
+/* Post a pseudo-random event sequence to each instance owned by a producer,
+ * injecting the same sequence into the reference instances.
+ */
+static void * produce(void * data) {
+    unsigned producer = (unsigned)(size_t)data;
+    unsigned seed = producer;
+    unsigned post;
+    unsigned instance;
+    int event;
+    void * arg;
+    for (post = 0; post < NUM_POSTS; post++) {
+        instance = producer + NUM_PRODUCERS * (rand_r(&seed) % (NUM_INSTANCES / NUM_PRODUCERS));
+        event = rand_r(&seed) % NUM_EVENT;
+        arg = &args[rand_r(&seed) % 2];
+        while (rsk_fsm_post(&actors[instance], event, arg)) {
+            sched_yield();
+        }
+        test_fsm_dispatch(&references[instance], event, arg);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    pthread_t producers[NUM_PRODUCERS];
+    unsigned index;
+    unsigned long dispatched = 0;
+    int failed = 0;
+    if (rsk_fsm_executor_init(&executor, 4, 16)) {
+        return 1;
+    }
+    for (index = 0; index < NUM_INSTANCES; index++) {
+        test_fsm_init(&fsms[index], &cb, 0, &args[0]);
+        test_fsm_init(&references[index], &cb, 0, &args[0]);
+        rsk_fsm_actor_init(&actors[index], &executor, index, &fsms[index], test_fsm_post, test_fsm_receive_batch);
+    }
+    if (rsk_fsm_executor_start(&executor)) {
+        return 1;
+    }
+    for (index = 0; index < NUM_PRODUCERS; index++) {
+        pthread_create(&producers[index], 0, produce, (void *)(size_t)index);
+    }
+    for (index = 0; index < NUM_PRODUCERS; index++) {
+        pthread_join(producers[index], 0);
+    }
+    rsk_fsm_executor_stop(&executor);
+    for (index = 0; index < executor.num_workers; index++) {
+        dispatched += executor.workers[index].dispatched;
+        printf("worker %u: dispatched %lu, stolen %lu\n", index, executor.workers[index].dispatched, executor.workers[index].stolen);
+    }
+    for (index = 0; index < NUM_INSTANCES; index++) {
+        if (fsms[index].state != references[index].state) {
+            printf("instance %u: state %d, expected %d\n", index, fsms[index].state, references[index].state);
+            failed = 1;
+        }
+    }
+    rsk_fsm_executor_fini(&executor);
+    printf("%s: dispatched %lu of %d events\n", failed || dispatched != NUM_PRODUCERS * NUM_POSTS ? "FAIL" : "PASS", dispatched, NUM_PRODUCERS * NUM_POSTS);
+    return failed;
+}
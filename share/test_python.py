@@ -0,0 +1,44 @@
+"""Drive the test FSM Python implementation in test_fsm, as test.c does."""
+
+import sys
+
+import test_fsm
+
+def _action(text):
+    """Return a callback action printing `text`."""
+    return staticmethod(lambda fsm, arg: print(text))
+
+class Callbacks(test_fsm.Callbacks):
+    """Callbacks printing each condition and action."""
+    @staticmethod
+    def condition_check(fsm, arg):
+        """Print and return whether `arg` is more than 1."""
+        check = int(arg > 1)
+        print(f'check? {check}')
+        return check
+    action_done = _action('(done)')
+    action_enter_A = _action('enter A')
+    action_enter_B = _action('enter B')
+    action_enter_C = _action('enter C')
+    action_enter_D = _action('enter D')
+    action_enter_E = _action('enter E')
+    action_enter_F = _action('enter F')
+    action_exit_A = _action('exit A')
+    action_exit_B = _action('exit B')
+    action_exit_C = _action('exit C')
+    action_exit_D = _action('exit D')
+    action_exit_E = _action('exit E')
+    action_exit_F = _action('exit F')
+    action_jump = _action('jump!')
+
+def main():
+    """Inject the events test.c injects, with the number of arguments."""
+    argc = len(sys.argv)
+    print('+++ init')
+    fsm = test_fsm.Fsm(Callbacks(), arg=argc)
+    for event in 'XXZXYY':
+        print(f'>>> inject {event}')
+        getattr(fsm, f'inject_{event}')(argc)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,12 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Hierarchical Finite State Machines."""
+
+def load(spec, **kwargs):
+    """Return a new module of the Python implementation of FSM `spec`.
+
+    See :func:`rsk_fsm.loader.load`.
+    """
+    # import on first use, not on importing any module of this package
+    from .loader import load as _load # pylint: disable=import-outside-toplevel
+    return _load(spec, **kwargs)
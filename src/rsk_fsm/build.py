@@ -31,6 +31,10 @@ that:
 
 # pylint: enable=line-too-long
 
+from multiprocessing import get_context
+
+from .report import phase
+
 NAME = r'[A-Za-z][A-Za-z_-]*'
 ABSOLUTE_STATE_POINTER_RE = r'^(/' + NAME + r')+$'
 RELATIVE_STATE_POINTER_RE = r'^(\.{1,2})(/\.{1,2})*' + r'(/' + NAME + r')*$'
@@ -202,6 +206,88 @@ class Transition():
         except KeyError:
             return False
 
+### the version of the intermediate representation from :meth:`Builder.get_ir`
+IR_VERSION = 1
+
+### the key of the version of an intermediate representation
+IR_KEY = 'rsk-fsm-ir'
+
+def is_ir(obj):
+    """Return True if `obj` is an intermediate representation of a FSM."""
+    return isinstance(obj, dict) and IR_KEY in obj
+
+def check_ir(ir):
+    """Raise :class:`ValueError` if `ir` is not a supported representation.
+
+    `ir` must be an intermediate representation of a FSM of version
+    :data:`IR_VERSION`, as returned by :meth:`Builder.get_ir`: each state
+    after its parent, and referring only to the states and events it defines.
+    """
+    if not is_ir(ir):
+        raise ValueError('not an intermediate representation of a FSM')
+    if ir[IR_KEY] != IR_VERSION:
+        raise ValueError(
+            f'unsupported intermediate representation version {ir[IR_KEY]}'
+        )
+    for key in (
+            'name', 'states', 'events', 'conditions', 'actions', 'initial',
+            'initial_transition', 'transitions',
+        ):
+        if key not in ir:
+            raise ValueError(f'intermediate representation has no {key}')
+    states = set()
+    for state in ir['states']:
+        if not isinstance(state, list) or len(state) != 3:
+            raise ValueError(f'malformed intermediate state {state!r}')
+        (pointer, parent, _) = state
+        if parent is not None and parent not in states:
+            raise ValueError(f'state {pointer} precedes its parent {parent}')
+        states.add(pointer)
+    for (pointer, _, initial) in ir['states']:
+        if initial not in states:
+            raise ValueError(
+                f'state {pointer} has undefined initial state {initial}'
+            )
+    if ir['initial'] not in states:
+        raise ValueError(f"undefined initial state {ir['initial']}")
+    for (event, transitions) in ir['transitions'].items():
+        if event not in ir['events']:
+            raise ValueError(f'transitions on undefined event {event}')
+        for pointer in transitions:
+            if pointer not in states:
+                raise ValueError(
+                    f'transitions on {event} in undefined state {pointer}'
+                )
+
+### the function called by :func:`_call_mapped` in a worker process
+_MAPPED = None
+
+def _call_mapped(arg):
+    """Return the result of calling the mapped function with `arg`."""
+    return _MAPPED(arg) # pylint: disable=not-callable
+
+def fork_map(function, args, jobs):
+    """Yield the result of calling `function` with each of `args`.
+
+    Yield results in the order of `args`. If `jobs` is more than one, then call
+    `function` in a pool of `jobs` worker processes. Each worker is forked from
+    this process, so `function` need not be picklable, but its results must be.
+    Arguments are sent to the workers in chunks, about four for each worker, as
+    :meth:`multiprocessing.pool.Pool.map` does, rather than one at a time.
+    """
+    if jobs <= 1:
+        yield from map(function, args)
+        return
+    args = list(args)
+    chunksize = max(1, -(-len(args) // (4 * jobs)))
+    global _MAPPED # pylint: disable=global-statement
+    _MAPPED = function
+    try:
+        with get_context('fork').Pool(jobs) as pool:
+            yield from pool.imap(_call_mapped, args, chunksize)
+    finally:
+        _MAPPED = None
+
 class Builder():
     """An abstract base class for building a target implementation of a FSM.
 
@@ -215,8 +301,16 @@ class Builder():
     * :attr:`events`, the set of FSM event names
     * :attr:`conditions`, the set of FSM condition names
     * :attr:`actions`, the set of FSM (entry, exit, transition) action names
+    * :attr:`ancestors`, a mapping of absolute state pointer to a tuple of the
+      absolute state pointers of the state and its ancestors, innermost first
     * :meth:`get_initial_transition`, returns the initial transition definition
     * :meth:`get_transitions`, returns a list of state transition definitions
+    * :meth:`map_events`, maps a function over events, in up to `jobs` processes
+    * :meth:`get_ir`, returns the intermediate representation of the FSM
+
+    A target implementation may also be built from an intermediate
+    representation of a FSM, by calling this class's :meth:`build_ir`, without
+    repeating the analysis of the FSM.
 
     Each transition definition is a dict specifying the transition to implement.
     The definition 'steps' is a list of dicts, with each dict defining either
@@ -230,14 +324,38 @@ class Builder():
     If `taken` is True, then the transition is taken if the named condition
     returns a truthy value; otherwise `taken` is False and the transition is
     taken if the named condition returns a falsy value.
+
+    If `report` is a :class:`rsk_fsm.report.Report` then record each build
+    phase in it, and statistics of the FSM. The transitions are then flattened
+    to an intermediate representation before building the target
+    implementation from it, so that each phase is recorded separately.
     """
-    def __init__(self, prefix):
+    def __init__(self, prefix, jobs=1, report=None):
         self._prefix = prefix
+        self._jobs = jobs
+        self.report = report
         self.initial = None
         self.states = {}
         self.events = set()
         self.conditions = set()
         self.actions = set()
+        self.ancestors = {}
+        ### a mapping of absolute state pointer to a mapping of event name to
+        ### the list of transitions on the event specified in that state
+        self._transitions_by_event = {}
+        ### interned state nodes: each state has an integer node id, in walk
+        ### order, indexing its pointer, parent node id (None for a root state),
+        ### depth (1 for a root state) and initial leaf node id
+        self._nodes = {}
+        self._pointers = []
+        self._parents = []
+        self._depths = []
+        self._initial_leaves = []
+        ### caches of common ancestor node ids and resolved next state pointers
+        self._common_ancestors = {}
+        self._next_states = {}
+        ### the intermediate representation being built from, if any
+        self._ir = None
     @staticmethod
     def error_not_a_state(string):
         """Raise :class:`ValueError`: the state in `string` is not a state."""
@@ -274,24 +392,126 @@ class Builder():
         - all states in `fsm` implement :class:`State`
         - all state transitions implement :class:`Transition`
         """
-        # prime instance variables for building
-        fsm.walk(self, [])
-        # integrity check the FSM
-        self._check_states(fsm.initial_state)
-        self._check_transitions()
-        # set the initial state pointer
-        self.initial = self.initial_state(
-            self.path_to_pointer([fsm.initial_state]),
-        )
-        # build the target implementation
-        implementation = self.build_implementation()
-        # clear instance variables for the next call to build
+        report = self.report
+        try:
+            # prime instance variables for building
+            with phase(report, 'walk'):
+                fsm.walk(self, [])
+            # integrity check the FSM
+            with phase(report, 'check states'):
+                self._check_states(fsm.initial_state)
+                self._resolve_initial_leaves()
+            with phase(report, 'check transitions'):
+                self._check_transitions()
+            # set the initial state pointer
+            self.initial = self.initial_state(
+                self.path_to_pointer([fsm.initial_state]),
+            )
+            # build the target implementation
+            if report is None:
+                return self.build_implementation()
+            with phase(report, 'flatten'):
+                ir = self.get_ir()
+        finally:
+            self._clear()
+        return self.build_ir(ir)
+    def build_ir(self, ir):
+        """Build and return the target implementation of FSM `ir`.
+
+        `ir` is an intermediate representation of a FSM, as returned by
+        :meth:`get_ir`. Raise :class:`ValueError` if `ir` is not an intermediate
+        representation of a supported version.
+        """
+        check_ir(ir)
+        if self.report is not None:
+            self.report.ir_stats(ir)
+        with phase(self.report, 'emit'):
+            return self._build_ir(ir)
+    def _build_ir(self, ir):
+        """Build and return the target implementation of FSM `ir`."""
+        try:
+            # prime instance variables for building
+            for (pointer, parent, _) in ir['states']:
+                self.states[pointer] = None
+                self.ancestors[pointer] = (
+                    (pointer,) + self.ancestors[parent]
+                    if parent else
+                    (pointer,)
+                )
+                self._nodes[pointer] = len(self._pointers)
+                self._pointers.append(pointer)
+            self._initial_leaves = [
+                self._nodes[initial] for (_, _, initial) in ir['states']
+            ]
+            self.events = set(ir['events'])
+            self.conditions = set(ir['conditions'])
+            self.actions = set(ir['actions'])
+            self.initial = ir['initial']
+            self._ir = ir
+            # build the target implementation
+            return self.build_implementation()
+        finally:
+            self._clear()
+    def get_ir(self):
+        """Return the intermediate representation of the FSM being built.
+
+        The intermediate representation is a dict, serialisable as JSON, of:
+
+        * :data:`IR_KEY`, the version of the intermediate representation
+        * 'name', this builder's prefix
+        * 'states', a list of [state pointer, parent state pointer or None,
+          initial state pointer], parents before children
+        * 'events', 'conditions' and 'actions', sorted lists of names
+        * 'initial', the absolute state pointer of the initial state
+        * 'initial_transition', the initial transition definition
+        * 'transitions', a mapping of event name to a mapping of absolute state
+          pointer to the (non-empty) list of transition definitions for the
+          event in the state
+        """
+        states = sorted(self.states)
+        events = sorted(self.events)
+        def event_transitions(event):
+            return {
+                state: transitions for (state, transitions) in (
+                    (_, self.get_transitions(event, _)) for _ in states
+                ) if transitions
+            }
+        return {
+            IR_KEY: IR_VERSION,
+            'name': self._prefix,
+            'states': [
+                [
+                    _,
+                    self.ancestors[_][1] if self.ancestors[_][1:] else None,
+                    self.initial_state(_),
+                ] for _ in states
+            ],
+            'events': events,
+            'conditions': sorted(self.conditions),
+            'actions': sorted(self.actions),
+            'initial': self.initial,
+            'initial_transition': self.get_initial_transition(),
+            'transitions': dict(zip(
+                events, self.map_events(event_transitions, events),
+            )),
+        }
+    def _clear(self):
+        """Clear instance variables for the next call to build."""
         self.initial = None
         self.states = {}
         self.events = set()
         self.conditions = set()
         self.actions = set()
-        return implementation
+        self.ancestors = {}
+        self._transitions_by_event = {}
+        self._nodes = {}
+        self._pointers = []
+        self._parents = []
+        self._depths = []
+        self._initial_leaves = []
+        self._common_ancestors = {}
+        self._next_states = {}
+        self._ir = None
     def _check_states(self, initial):
         """Perform an integrity check of the FSM states.
 
@@ -313,6 +533,19 @@ class Builder():
                 self.error_not_a_state(
                     f'initial state "{i_name}" of state "{pointer}"'
                 )
+    def _resolve_initial_leaves(self):
+        """Resolve the initial leaf node of each state node.
+
+        A child state node is always walked after its parent, so resolving in
+        reverse walk order resolves each initial child before its parent.
+        """
+        leaves = list(range(len(self._pointers)))
+        for node in reversed(leaves):
+            pointer = self._pointers[node]
+            i_name = self.states[pointer].initial_state
+            if i_name is not None:
+                leaves[node] = leaves[self._nodes[f'{pointer}/{i_name}']]
+        self._initial_leaves = leaves
     def _check_transitions(self):
         """Perform an integrity check of the FSM transitions.
 
@@ -339,13 +572,25 @@ class Builder():
         if pointer in self.states:
             raise ValueError(f'duplicate state {pointer}')
         self.states[pointer] = state
+        # record the ancestor chain of `state`, innermost first
+        parent = self.path_to_pointer(path[:-1]) if path[1:] else None
+        self.ancestors[pointer] = (
+            (pointer,) + self.ancestors[parent] if parent else (pointer,)
+        )
+        # intern `state` as a node
+        self._nodes[pointer] = len(self._pointers)
+        self._pointers.append(pointer)
+        self._parents.append(self._nodes[parent] if parent else None)
+        self._depths.append(len(path))
         # accumulate action, event and condition names
         for action in state.exit_actions:
             self.actions.add(action)
         for action in state.enter_actions:
             self.actions.add(action)
+        by_event = self._transitions_by_event[pointer] = {}
         for transition in state.transitions:
             self.events.add(transition.event)
+            by_event.setdefault(transition.event, []).append(transition)
             condition = transition.condition[0]
             if condition:
                 self.conditions.add(condition)
@@ -359,6 +604,13 @@ class Builder():
     def build_implementation(self):
         """Build and return the target implementation."""
         raise NotImplementedError
+    def map_events(self, function, events):
+        """Yield the result of calling `function` with each of `events`.
+
+        Yield results in the order of `events`, calling `function` in up to
+        this builder's number of jobs worker processes. See :func:`fork_map`.
+        """
+        return fork_map(function, events, self._jobs)
     def initial_state(self, pointer):
         """Return a pointer to the initial state of the state at `pointer`.
 
@@ -370,15 +622,35 @@ class Builder():
         Raise :class:`ValueError` if `pointer` does not point to a state.
         """
         try:
-            state = self.states[pointer]
+            node = self._nodes[pointer]
         except KeyError:
             raise ValueError(pointer) # pylint: disable=raise-missing-from
-        path = self.pointer_to_path(pointer)
-        while state.initial_state:
-            path.append(state.initial_state)
-            pointer = self.path_to_pointer(path)
-            state = self.states[pointer]
-        return pointer
+        return self._pointers[self._initial_leaves[node]]
+    def _common_ancestor(self, node, other):
+        """Return the node id of the common ancestor of `node` and `other`.
+
+        Return the node id of the innermost state which is either of, or an
+        ancestor of both, state nodes `node` and `other`. If either is None,
+        or the states have no common ancestor, return None.
+        """
+        if node is None or other is None:
+            return None
+        key = (node, other)
+        try:
+            return self._common_ancestors[key]
+        except KeyError:
+            pass
+        parents = self._parents
+        depths = self._depths
+        while depths[node] > depths[other]:
+            node = parents[node]
+        while depths[other] > depths[node]:
+            other = parents[other]
+        while node != other:
+            node = parents[node]
+            other = parents[other]
+        self._common_ancestors[key] = node
+        return node
     def _exit_steps(self, src, dst):
         """Return a list of the exit steps to take for an external transition.
 
@@ -394,13 +666,12 @@ class Builder():
                 {'state': src},
             ]
         # exit each state from `src` up to the common parent of `src` and `dst`
-        src_path = self.pointer_to_path(src)
-        dst_path = self.pointer_to_path(dst) if dst else []
+        node = self._nodes[src]
+        common = self._common_ancestor(node, self._nodes[dst] if dst else None)
         steps = []
-        path = list(src_path)
-        while path != dst_path[:len(path)]:
-            pointer = self.path_to_pointer(path)
-            path.pop()
+        while node != common:
+            pointer = self._pointers[node]
+            node = self._parents[node]
             # perform exit actions before formally leaving the state
             steps += [
                 {'actions': self.states[pointer].exit_actions},
@@ -422,25 +693,22 @@ class Builder():
                 {'actions': self.states[dst].enter_actions},
             ]
         # enter each state from the common parent with `src` down to `dst`
-        src_path = self.pointer_to_path(src) if src else []
-        dst_path = self.pointer_to_path(dst)
+        node = self._nodes[dst]
+        common = self._common_ancestor(self._nodes[src] if src else None, node)
         steps = []
-        path = list(src_path)
-        # pop up to the common parent of `src` and `dst`
-        while path != dst_path[:len(path)]:
-            path.pop()
-        if path == dst_path:
+        if node == common:
             # no enter actions to perform as target state is the common parent
-            pointer = self.path_to_pointer(path)
             steps += [
-                {'state': pointer},
+                {'state': dst},
             ]
         else:
             # enter each state from the common parent of `src` and `dst`,
             # down to `dst`
-            while path != dst_path:
-                path.append(dst_path[len(path)])
-                pointer = self.path_to_pointer(path)
+            entered = []
+            while node != common:
+                entered.append(self._pointers[node])
+                node = self._parents[node]
+            for pointer in reversed(entered):
                 # perform enter actions after formally entering the state
                 steps += [
                     {'state': pointer},
@@ -449,6 +717,8 @@ class Builder():
         return steps
     def get_initial_transition(self):
         """Return a dict with 'steps' for the initial transition of the FSM."""
+        if self._ir is not None:
+            return self._ir['initial_transition']
         return {'steps': self._enter_steps(None, self.initial)}
     def _next_state(self, next_state, path):
         """Return an absolute state pointer to `next_state` relative to `path`.
@@ -485,6 +755,20 @@ class Builder():
             path[-1] = next_state
             dst = self.path_to_pointer(path)
         return self.initial_state(dst)
+    def _resolve_next_state(self, next_state, pointer):
+        """Return an absolute state pointer to `next_state` from `pointer`.
+
+        As :meth:`_next_state`, with the context state at absolute state
+        `pointer`, caching the result.
+        """
+        key = (next_state, pointer)
+        try:
+            return self._next_states[key]
+        except KeyError:
+            pass
+        dst = self._next_state(next_state, self.pointer_to_path(pointer))
+        self._next_states[key] = dst
+        return dst
     def get_transitions(self, event, src):
         """Return a list of dicts with 'steps' for handling `event`.
 
@@ -496,14 +780,19 @@ class Builder():
         unconditional transition is encountered while generating the list, no
         further objects will be added to the list.
         """
-        path = self.pointer_to_path(src)
+        if self._ir is not None:
+            try:
+                return self._ir['transitions'][event][src]
+            except KeyError:
+                return []
         # inherit transitions in reverse state nesting order
         transitions = []
-        while path:
-            state = self.states[self.path_to_pointer(path)]
-            for transition in state.transitions:
-                if transition.event != event:
-                    continue
+        for pointer in self.ancestors[src]:
+            try:
+                candidates = self._transitions_by_event[pointer][event]
+            except KeyError:
+                continue
+            for transition in candidates:
                 if transition.next_state is False:
                     # internal transition: never leave current state
                     steps = [
@@ -511,7 +800,9 @@ class Builder():
                     ]
                 else:
                     # external transition: always leave current state
-                    dst = self._next_state(transition.next_state, list(path))
+                    dst = self._resolve_next_state(
+                        transition.next_state, pointer,
+                    )
                     steps = []
                     steps += self._exit_steps(src, dst)
                     if not dst:
@@ -532,5 +823,4 @@ class Builder():
                 if condition is None:
                     # unconditional transition: ignore further transitions
                     return transitions
-            path.pop()
         return transitions
@@ -0,0 +1,106 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""A content-hash cache of FSM target implementations.
+
+An entry in the cache maps file names to file contents, for the files written
+when compiling a FSM specification. An entry is keyed by a hash of everything
+which determines the implementation: see :meth:`Cache.key`. The generator
+version is a digest of the sources of this package, so that any change to the
+generator invalidates every entry.
+
+The cache also stores marshalled objects, such as the compiled bytecode of a
+Python implementation, with :meth:`Cache.put_code`. The key of such an entry
+should include the Python version (:data:`importlib.util.MAGIC_NUMBER`).
+"""
+
+import hashlib
+import json
+import marshal
+import os
+import tempfile
+
+PACKAGE_DIR = os.path.dirname(os.path.abspath(__file__))
+
+### the file name extensions of the sources of this package
+SOURCE_EXTENSIONS = ('.py', '.c', '.h')
+
+_SOURCE_DIGEST = None
+
+def source_digest():
+    """Return a hex digest of the sources of this package."""
+    global _SOURCE_DIGEST # pylint: disable=global-statement
+    if _SOURCE_DIGEST is None:
+        digest = hashlib.sha256()
+        for (dirpath, dirnames, filenames) in os.walk(PACKAGE_DIR):
+            dirnames.sort()
+            for name in sorted(filenames):
+                if not name.endswith(SOURCE_EXTENSIONS):
+                    continue
+                path = os.path.join(dirpath, name)
+                digest.update(os.path.relpath(path, PACKAGE_DIR).encode())
+                with open(path, 'rb') as fid:
+                    digest.update(hashlib.sha256(fid.read()).digest())
+        _SOURCE_DIGEST = digest.hexdigest()
+    return _SOURCE_DIGEST
+
+class Cache():
+    """A content-hash cache of FSM target implementations in `directory`."""
+    def __init__(self, directory):
+        self._directory = directory
+    @staticmethod
+    def key(**inputs):
+        """Return the cache key for the JSON serialisable values in `inputs`.
+
+        The key is a hex digest of `inputs` and the generator version.
+        """
+        digest = hashlib.sha256(source_digest().encode())
+        digest.update(json.dumps(inputs, sort_keys=True).encode())
+        return digest.hexdigest()
+    def _path(self, key, suffix='.json'):
+        """Return the path of the cache entry file for `key`."""
+        return os.path.join(self._directory, key[:2], key + suffix)
+    def get(self, key):
+        """Return the entry, a mapping of file name to contents, for `key`.
+
+        Return None if there is no valid entry for `key`.
+        """
+        try:
+            with open(self._path(key), encoding='utf-8') as fid:
+                entry = json.load(fid)
+        except (OSError, ValueError):
+            return None
+        if not isinstance(entry, dict):
+            return None
+        return entry
+    def put(self, key, entry):
+        """Store `entry`, a mapping of file name to contents, for `key`.
+
+        The entry is written to a temporary file then renamed, so that
+        concurrent readers and writers never see a partial entry.
+        """
+        self._replace(self._path(key), json.dumps(entry).encode('utf-8'))
+    def get_code(self, key):
+        """Return the marshalled object for `key`.
+
+        Return None if there is no valid marshalled object for `key`.
+        """
+        try:
+            with open(self._path(key, '.marshal'), 'rb') as fid:
+                return marshal.load(fid)
+        except (OSError, EOFError, ValueError, TypeError):
+            return None
+    def put_code(self, key, obj):
+        """Store `obj`, marshalled, for `key`. See :meth:`put`."""
+        self._replace(self._path(key, '.marshal'), marshal.dumps(obj))
+    @staticmethod
+    def _replace(path, data):
+        """Atomically replace the file at `path` with bytes `data`."""
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        (fd, tmp) = tempfile.mkstemp(dir=os.path.dirname(path), suffix='.tmp')
+        try:
+            with os.fdopen(fd, 'wb') as fid:
+                fid.write(data)
+            os.replace(tmp, path)
+        except BaseException:
+            os.unlink(tmp)
+            raise
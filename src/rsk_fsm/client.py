@@ -0,0 +1,53 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""A client for the compile server of :mod:`rsk_fsm.compile`.
+
+Run this module with the compile server socket path and the arguments to pass
+to the compiler, for example::
+
+    python3 -m rsk_fsm.compile --serve /tmp/rsk-fsm.sock &
+    python3 -m rsk_fsm.client /tmp/rsk-fsm.sock test.fsm C --output-dir build
+
+This module depends only on the Python standard library, so that a client
+starts without loading the compiler or the schema.
+"""
+
+import json
+import os
+import socket
+import sys
+
+def request(path, argv, cwd=None):
+    """Request a compile with command line `argv` from the server at `path`.
+
+    Relative paths in `argv` are relative to `cwd`, by default the current
+    working directory. Return the server response, a dict with the 'status' of
+    the request and the 'stdout' and 'stderr' output of the compiler.
+    """
+    message = json.dumps({
+        'argv': list(argv),
+        'cwd': cwd if cwd else os.getcwd(),
+    }).encode('utf-8') + b'\n'
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(path)
+        sock.sendall(message)
+        sock.shutdown(socket.SHUT_WR)
+        chunks = []
+        while True:
+            chunk = sock.recv(65536)
+            if not chunk:
+                break
+            chunks.append(chunk)
+    return json.loads(b''.join(chunks))
+
+def main():
+    """Request a compile from a compile server."""
+    if len(sys.argv) < 2:
+        sys.exit(f'usage: {sys.argv[0]} SOCKET [ARG ...]')
+    response = request(sys.argv[1], sys.argv[2:])
+    sys.stdout.write(response['stdout'])
+    sys.stderr.write(response['stderr'])
+    sys.exit(response['status'])
+
+if __name__ == '__main__':
+    main()
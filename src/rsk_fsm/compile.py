@@ -1,22 +1,36 @@
 ### SPDX-License-Identifier: GPL-2.0-or-later
 
-"""Compile a FSM specification into a target implementation."""
+"""Compile FSM specifications into target implementations."""
 
 from argparse import ArgumentParser
+import hashlib
+import json
+import os
 import re
 import sys
-from contextlib import nullcontext
+import traceback
+from contextlib import (nullcontext, redirect_stdout, redirect_stderr)
+from io import StringIO
+from socketserver import (StreamRequestHandler, UnixStreamServer)
 
 from rsk_mt.jsonschema.schema import (RootSchema, Support)
 from rsk_mt.jsonschema.formats import Format
 
-from .build import (FORMATS, Fsm, State, Transition)
+from .build import (
+    FORMATS, IR_KEY, Fsm, State, Transition, check_ir, fork_map, is_ir,
+)
+from .cache import Cache
+from .report import (Report, phase)
 
 from .target.c import Builder as CBuilder
+from .target.ir import Builder as IRBuilder
 from .target.python import Builder as PythonBuilder
+from .target.pythonc import Builder as PythonCBuilder
 
 SCHEMA_URI = 'https://json-schema.roughsketch.co.uk/rsk-fsm/fsm.json'
 
+SCHEMA_FILE = '/usr/share/json-schema/rsk-fsm/fsm.json'
+
 BASES = {
     SCHEMA_URI + '#fsm': (Fsm,),
     SCHEMA_URI + '#state': (State,),
@@ -26,6 +40,17 @@ BASES = {
 BUILDERS = {
     'C': CBuilder,
     'Python': PythonBuilder,
+    'PythonC': PythonCBuilder,
+    'IR': IRBuilder,
+}
+
+### a mapping of target to the names of the target builder's options
+OPTIONS = {
+    'C': ('broadcast', 'queue', 'mailbox', 'dispatch', 'atomic', 'shards',
+          'replay'),
+    'Python': ('vectorise', 'asyncio', 'match'),
+    'PythonC': (),
+    'IR': (),
 }
 
 class _FormatRegexp(Format):
@@ -38,49 +63,433 @@ class _FormatRegexp(Format):
     def validates(self, primitive):
         return primitive == 'string'
 
-def main():
-    """Compile a FSM specification into a target implementation."""
-    aparser = ArgumentParser(description=main.__doc__)
+### the cache entry file name for an implementation written to stdout
+STDOUT = '-'
+
+def _write_entry(entry, output_dir):
+    """Write cache `entry` to files in `output_dir`, or to stdout if None."""
+    if output_dir:
+        for (name, contents) in entry.items():
+            path = os.path.join(output_dir, name)
+            with open(path, 'w', encoding='utf-8') as fid:
+                fid.write(contents)
+    else:
+        sys.stdout.write(entry[STDOUT])
+
+def _read_entry(names, output_dir):
+    """Return a cache entry for the files `names` written to `output_dir`."""
+    entry = {}
+    for name in names:
+        with open(os.path.join(output_dir, name), encoding='utf-8') as fid:
+            entry[name] = fid.read()
+    return entry
+
+### a mapping of (schema path, formats) to the digest of the schema file and
+### the schema loaded from it, shared by compilers
+_SCHEMAS = {}
+
+def load_schema(path, formats):
+    """Return the schema at `path`, enforcing `formats`.
+
+    `formats` is a mapping of format name to regular expression. The schema is
+    loaded at most once for each `path` and `formats`, and again only if the
+    schema file changes (see :func:`schema_digest`).
+    """
+    key = (path, tuple(sorted(formats.items())))
+    digest = schema_digest(path)
+    try:
+        (loaded, schema) = _SCHEMAS[key]
+        if digest is not None and loaded == digest:
+            return schema
+    except KeyError:
+        pass
+    schema = RootSchema.load(
+        path, support=Support(
+            bases=BASES,
+            formats={
+                fmt: _FormatRegexp(fmt, regexp)
+                for (fmt, regexp) in formats.items()
+            },
+        ),
+    )
+    _SCHEMAS[key] = (digest, schema)
+    return schema
+
+### a mapping of (schema path, modification time) to digest
+_DIGESTS = {}
+
+def schema_digest(path):
+    """Return a digest of the schema file at `path`, or None if unreadable.
+
+    The file is only read and hashed again if its modification time changes.
+    """
+    try:
+        key = (path, os.stat(path).st_mtime_ns)
+        try:
+            return _DIGESTS[key]
+        except KeyError:
+            pass
+        with open(path, 'rb') as fid:
+            digest = _DIGESTS[key] = hashlib.sha256(fid.read()).hexdigest()
+        return digest
+    except OSError:
+        return None
+
+class CompileError(Exception):
+    """An error compiling a FSM specification."""
+
+class Compiler():
+    """A compiler of FSM specifications into target implementations.
+
+    `args` are the parsed command line arguments of :func:`main`. The schema is
+    loaded at most once, when first needed, and is shared by each FSM
+    specification compiled.
+    """
+    def __init__(self, args):
+        self._args = args
+        self._formats = {
+            fmt: getattr(args, fmt.replace('-', '_')) for (fmt, _) in FORMATS
+        }
+        self._options = {_: getattr(args, _) for _ in OPTIONS[args.target]}
+        self._cache = Cache(args.cache_dir) if args.cache_dir else None
+        self._schema_digest = (
+            schema_digest(args.schema) if args.cache_dir else None
+        )
+        self._schema = None
+    @property
+    def schema(self):
+        """Return the schema for validating FSM specifications."""
+        if self._schema is None:
+            self._schema = load_schema(self._args.schema, self._formats)
+        return self._schema
+    def check_outputs(self, paths):
+        """Raise :class:`CompileError` if FSMs in `paths` share output files.
+
+        The output files of a FSM are named from its prefix, the FSM name, so
+        FSMs with the same name would overwrite each other's output. A FSM
+        specification which cannot be read is left for :meth:`compile` to
+        report.
+        """
+        names = {}
+        for path in paths:
+            try:
+                with open(path, encoding='utf-8') as fid:
+                    name = json.load(fid)['name']
+            except (OSError, ValueError, KeyError, TypeError):
+                continue
+            if name in names:
+                raise CompileError(
+                    f'{path}: FSM {name} would overwrite the output of'
+                    f' {names[name]}'
+                )
+            names[name] = path
+    def compile(self, path, jobs=1):
+        """Compile the FSM specification in file `path`, or stdin if '-'.
+
+        Build the implementation in `jobs` worker processes. Raise
+        :class:`CompileError` if the FSM cannot be compiled. If reporting, write
+        a :class:`rsk_fsm.report.Report` to stderr.
+        """
+        report = Report(path) if self._args.report else None
+        try:
+            self._compile(path, jobs, report)
+        finally:
+            if report is not None:
+                report.write(sys.stderr)
+    def _compile(self, path, jobs, report):
+        """Compile the FSM specification in file `path`, recording `report`."""
+        args = self._args
+        with (  open(path, encoding='utf-8')
+                if path != '-' else
+                nullcontext(sys.stdin)
+            ) as fid:
+            spec = fid.read()
+        if self._cache:
+            key = self._cache.key(
+                spec=spec,
+                schema=self._schema_digest,
+                prefix=args.prefix,
+                target=args.target,
+                options=self._options,
+                formats=self._formats,
+                files=bool(args.output_dir),
+            )
+            with phase(report, 'cache lookup'):
+                entry = self._cache.get(key)
+            if entry is not None:
+                with phase(report, 'write'):
+                    _write_entry(entry, args.output_dir)
+                return
+        # an intermediate representation is built from without validation
+        fsm = None
+        if IR_KEY in spec:
+            try:
+                fsm = json.loads(spec)
+            except ValueError as exc:
+                raise CompileError(f'{path}: {exc}') from exc
+        if is_ir(fsm):
+            try:
+                check_ir(fsm)
+            except ValueError as exc:
+                raise CompileError(f'{path}: {exc}') from exc
+        else:
+            with phase(report, 'schema load'):
+                schema = self.schema
+            with phase(report, 'decode'):
+                fsm = schema.decode(spec)
+        try:
+            prefix = args.prefix if args.prefix else fsm['name']
+        except KeyError:
+            raise CompileError( # pylint: disable=raise-missing-from
+                f"{path}: FSM has no name: must supply a prefix"
+            )
+        builder = BUILDERS[args.target](
+            prefix, jobs=jobs, report=report, **self._options,
+        )
+        # the builders raise ValueError for a FSM which cannot be built, or
+        # built with the options given; unless reporting, the C handlers are
+        # built as written
+        try:
+            implementation = (
+                builder.build_ir(fsm) if is_ir(fsm) else builder.build(fsm)
+            )
+            with phase(report, 'write'):
+                self._write(implementation, key if self._cache else None)
+        except ValueError as exc:
+            raise CompileError(f'{path}: {exc}') from exc
+    def _write(self, implementation, key):
+        """Write `implementation`, caching it at `key` if not None."""
+        args = self._args
+        if args.output_dir:
+            names = implementation.write_files(args.output_dir)
+            if key:
+                self._cache.put(key, _read_entry(names, args.output_dir))
+        elif key:
+            fid = StringIO()
+            implementation.write(fid)
+            fid.write('\n')
+            self._cache.put(key, {STDOUT: fid.getvalue()})
+            sys.stdout.write(fid.getvalue())
+        else:
+            implementation.write(sys.stdout)
+            sys.stdout.write('\n')
+
+def _parser():
+    """Return the command line argument parser for :func:`main`."""
+    aparser = ArgumentParser(
+        description=main.__doc__, fromfile_prefix_chars='@',
+    )
     aparser.add_argument(
-        '-s', '--schema', default='/usr/share/json-schema/rsk-fsm/fsm.json',
+        '--serve', metavar='SOCKET',
+        help="serve compile requests on Unix domain socket SOCKET, keeping"
+        " the schema loaded (see rsk_fsm.client); other arguments are ignored",
+    )
+    aparser.add_argument(
+        '-s', '--schema', default=SCHEMA_FILE,
         help="the JSON Schema to validate the input fsm against",
     )
     aparser.add_argument(
         '-p', '--prefix',
         help="implementation prefix (default: the FSM name is used)",
     )
+    aparser.add_argument(
+        '-j', '--jobs', type=int, default=1, metavar='N',
+        help="build in N worker processes, or compile each FSM in one of N"
+        " worker processes if there is more than one (default: 1)",
+    )
+    aparser.add_argument(
+        '-o', '--output-dir', metavar='DIR',
+        help="write the implementation to files in DIR"
+        " (default: write to stdout)",
+    )
+    aparser.add_argument(
+        '--report', action='store_true',
+        help="report the time and peak memory of each phase of compiling"
+        " each FSM, and statistics of the FSM, to stderr",
+    )
+    aparser.add_argument(
+        '--cache-dir', metavar='DIR',
+        help="reuse implementations cached in DIR, keyed by a hash of the"
+        " inputs and the generator version (default: no cache)",
+    )
     for (fmt, regexp) in FORMATS:
         aparser.add_argument(
             f'--{fmt}', default=regexp,
             help=f"regular expression for format {fmt} (default: {regexp!r})",
         )
+    c_options = aparser.add_argument_group('C target options')
+    c_options.add_argument(
+        '--broadcast', action='store_true',
+        help="support broadcasting an event to each instance in a state",
+    )
+    c_options.add_argument(
+        '--queue', type=int, default=0, metavar='CAPACITY',
+        help="queue events injected during a transition (default: 0, none)",
+    )
+    c_options.add_argument(
+        '--mailbox', type=int, default=0, metavar='CAPACITY',
+        help="lock-free mailbox for posting events from any thread"
+        " (a power of 2, default: 0, none)",
+    )
+    c_options.add_argument(
+        '--dispatch', action='store_true',
+        help="support injecting an event by number, and with --mailbox posting"
+        " an event by number, e.g. by the executor runtime",
+    )
+    c_options.add_argument(
+        '--atomic', action='store_true',
+        help="atomic state, for injecting events from several threads",
+    )
+    c_options.add_argument(
+        '--shards', type=int, default=0, metavar='N',
+        help="divide the event handlers between N source files, or one for"
+        " each handler if fewer, for compiling in parallel (requires"
+        " --output-dir, default: 0, none)",
+    )
+    c_options.add_argument(
+        '--replay', action='store_true',
+        help="add a driver replaying a binary event log with the replay"
+        " runtime (implies --dispatch, requires --output-dir)",
+    )
+    python_options = aparser.add_argument_group('Python target options')
+    python_options.add_argument(
+        '--vectorise', action='store_true',
+        help="add a NumPy engine stepping many instances of a FSM without"
+        " conditions or actions at once",
+    )
+    python_options.add_argument(
+        '--asyncio', action='store_true',
+        help="build for asyncio, with awaitable conditions and actions and"
+        " a queue of events for each instance",
+    )
+    python_options.add_argument(
+        '--match', action='store_true',
+        help="dispatch events with a match statement in one inject method,"
+        " instead of a handler function for each event in each state",
+    )
     aparser.add_argument(
-        'fsm',
-        help="the JSON FSM file to compile, or '-' to read from stdin",
+        'fsm', nargs='+',
+        help="the JSON FSM files, or intermediate representation files from"
+        " target IR, to compile, or '-' to read from stdin;"
+        " an argument @FILE is replaced by the arguments in FILE, one per line",
     )
     aparser.add_argument(
         'target', choices=tuple(BUILDERS),
         help="the target implementation",
     )
-    args = aparser.parse_args()
-    schema = RootSchema.load(args.schema, support=Support(
-        bases=BASES,
-        formats={
-            fmt: _FormatRegexp(fmt, getattr(args, fmt.replace('-', '_')))
-            for (fmt, _) in FORMATS
-        },
-    ))
-    with (  open(args.fsm, encoding='utf-8')
-            if args.fsm != '-' else
-            nullcontext(sys.stdin)
-        ) as fid:
-        fsm = schema.decode(fid.read())
+    return aparser
+
+def run(argv, serving=False):
+    """Compile FSM specifications as specified by command line `argv`.
+
+    If `serving` then `argv` is a compile server request.
+    """
+    aparser = _parser()
+    args = aparser.parse_args(argv)
+    if serving and '-' in args.fsm:
+        aparser.error("the compile server cannot read '-'")
+    if args.queue < 0:
+        aparser.error('--queue must not be negative')
+    if args.mailbox < 0 or args.mailbox & (args.mailbox - 1):
+        aparser.error('--mailbox must be a power of 2')
+    if args.shards < 0:
+        aparser.error('--shards must not be negative')
+    if args.match and args.asyncio:
+        aparser.error('--match cannot be combined with --asyncio')
+    if args.shards and not args.output_dir:
+        aparser.error('--shards requires --output-dir')
+    if args.replay and not args.output_dir:
+        aparser.error('--replay requires --output-dir')
+    if args.atomic and (args.broadcast or args.queue):
+        aparser.error('--atomic cannot be combined with --broadcast or --queue')
+    if args.replay and args.broadcast:
+        aparser.error('--replay cannot be combined with --broadcast')
+    if args.fsm[1:]:
+        if not args.output_dir:
+            aparser.error('compiling more than one FSM requires --output-dir')
+        if args.prefix:
+            aparser.error('--prefix requires exactly one FSM')
+        if '-' in args.fsm:
+            aparser.error("'-' requires exactly one FSM")
+    compiler = Compiler(args)
     try:
-        prefix = args.prefix if args.prefix else fsm['name']
-    except KeyError:
-        sys.exit("FSM has no name: must supply a prefix")
-    implementation = BUILDERS[args.target](prefix).build(fsm)
-    print(str(implementation))
+        if args.fsm[1:]:
+            compiler.check_outputs(args.fsm)
+        if args.fsm[1:] and args.jobs > 1:
+            # load the schema once, before forking workers
+            if not args.cache_dir:
+                compiler.schema # pylint: disable=pointless-statement
+            for _ in fork_map(compiler.compile, args.fsm, args.jobs):
+                pass
+        else:
+            for path in args.fsm:
+                compiler.compile(path, args.jobs)
+    except CompileError as exc:
+        sys.exit(str(exc))
+
+class _RequestHandler(StreamRequestHandler):
+    """A handler of compile server requests.
+
+    A request is a line of JSON, an object with 'argv', the command line
+    arguments to :func:`run`, and 'cwd', the client working directory, in which
+    the request runs; the server working directory is then restored. The
+    response is a line of JSON, an object with the 'status' of the request
+    and the 'stdout' and 'stderr' output of the compiler.
+    """
+    def handle(self):
+        (stdout, stderr) = (StringIO(), StringIO())
+        status = 0
+        cwd = os.getcwd()
+        with redirect_stdout(stdout), redirect_stderr(stderr):
+            try:
+                request = json.loads(self.rfile.readline())
+                os.chdir(request['cwd'])
+                run(request['argv'], serving=True)
+            except SystemExit as exc:
+                if isinstance(exc.code, str):
+                    stderr.write(exc.code + '\n')
+                    status = 1
+                else:
+                    status = exc.code if exc.code else 0
+            except Exception: # pylint: disable=broad-except
+                stderr.write(traceback.format_exc())
+                status = 1
+            finally:
+                os.chdir(cwd)
+        self.wfile.write(json.dumps({
+            'status': status,
+            'stdout': stdout.getvalue(),
+            'stderr': stderr.getvalue(),
+        }).encode('utf-8') + b'\n')
+
+def make_server(path):
+    """Return a compile server bound to Unix domain socket `path`.
+
+    The server handles one request at a time.
+    """
+    return UnixStreamServer(path, _RequestHandler)
+
+def serve(path):
+    """Serve compile requests on Unix domain socket `path` until interrupted."""
+    # each request runs in the client's working directory
+    path = os.path.abspath(path)
+    with make_server(path) as server:
+        try:
+            server.serve_forever()
+        except KeyboardInterrupt:
+            pass
+        finally:
+            os.unlink(path)
+
+def main():
+    """Compile FSM specifications into target implementations."""
+    aparser = ArgumentParser(add_help=False)
+    aparser.add_argument('--serve')
+    (args, _) = aparser.parse_known_args()
+    if args.serve:
+        serve(args.serve)
+    else:
+        run(sys.argv[1:])
 
 if __name__ == '__main__':
     main()
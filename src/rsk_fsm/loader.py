@@ -0,0 +1,94 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Load a Python implementation of a FSM without writing source files.
+
+:func:`load` builds the Python target implementation of a FSM specification,
+compiles it to bytecode and executes it in a new module. The bytecode is
+cached in memory, and optionally in a :class:`rsk_fsm.cache.Cache` directory,
+keyed by a hash of the specification and everything else which determines the
+implementation, so that loading the same FSM again does not build it again.
+"""
+
+import json
+
+from importlib.util import MAGIC_NUMBER
+from types import (CodeType, ModuleType)
+
+from .build import (FORMATS, check_ir, is_ir)
+from .cache import Cache
+from .compile import (CompileError, SCHEMA_FILE, load_schema, schema_digest)
+from .target.python import Builder
+
+### a mapping of cache key to (module name, code), shared by loaders
+_CODE = {}
+
+def _compile(spec, prefix, schema, options):
+    """Return (module name, code) for the FSM specification `spec`."""
+    # an intermediate representation is built from without validation
+    try:
+        fsm = json.loads(spec)
+    except ValueError as exc:
+        raise CompileError(str(exc)) from exc
+    if is_ir(fsm):
+        try:
+            check_ir(fsm)
+        except ValueError as exc:
+            raise CompileError(str(exc)) from exc
+    else:
+        fsm = load_schema(schema, dict(FORMATS)).decode(spec)
+    try:
+        prefix = prefix if prefix else fsm['name']
+    except KeyError:
+        raise CompileError( # pylint: disable=raise-missing-from
+            'FSM has no name: must supply a prefix'
+        )
+    builder = Builder(prefix, **options)
+    implementation = (
+        builder.build_ir(fsm) if is_ir(fsm) else builder.build(fsm)
+    )
+    name = f'{prefix}_fsm'
+    return (name, compile(str(implementation), f'<{name}>', 'exec'))
+
+def _is_entry(entry):
+    """Return True if `entry` is (module name, code), as from :func:`_compile`.
+    """
+    return (
+        isinstance(entry, tuple) and len(entry) == 2
+        and isinstance(entry[0], str) and isinstance(entry[1], CodeType)
+    )
+
+def load(spec, prefix=None, schema=SCHEMA_FILE, cache_dir=None, **options):
+    """Return a new module of the Python implementation of FSM `spec`.
+
+    `spec` is a FSM specification or intermediate representation, either JSON
+    text or the decoded JSON value. `prefix` is the implementation prefix
+    (default: the FSM name), `schema` is the path of the JSON Schema to
+    validate `spec` against and `options` are Python target builder options.
+    If `cache_dir` then cache the bytecode in this directory, for other
+    processes. Raise :class:`rsk_fsm.compile.CompileError` if the FSM cannot
+    be compiled.
+    """
+    if not isinstance(spec, str):
+        spec = json.dumps(spec, sort_keys=True)
+    key = Cache.key(
+        spec=spec,
+        schema=schema_digest(schema),
+        prefix=prefix,
+        target='Python',
+        options=options,
+        python=MAGIC_NUMBER.hex(),
+    )
+    try:
+        (name, code) = _CODE[key]
+    except KeyError:
+        cache = Cache(cache_dir) if cache_dir else None
+        entry = cache.get_code(key) if cache else None
+        # a corrupt or foreign cache file is a cache miss
+        if not _is_entry(entry):
+            entry = _compile(spec, prefix, schema, options)
+            if cache:
+                cache.put_code(key, entry)
+        (name, code) = _CODE[key] = entry
+    module = ModuleType(name)
+    exec(code, module.__dict__) # pylint: disable=exec-used
+    return module
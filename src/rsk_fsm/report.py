@@ -0,0 +1,101 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Report generator phase timings and output statistics.
+
+A :class:`Report` records the wall time and peak (Python) memory allocated in
+each phase of generating a target implementation, and statistics about the
+FSM being generated, for finding out why a FSM is slow to generate or results
+in a large implementation.
+"""
+
+import json
+import resource
+import struct
+import tracemalloc
+
+from contextlib import (contextmanager, nullcontext)
+from time import perf_counter
+
+### the size in bytes of an entry in a C handler table, a function pointer, as
+### on the host running this Python
+TABLE_ENTRY_SIZE = struct.calcsize('P')
+
+def phase(report, name):
+    """Return a context manager recording phase `name` in `report`.
+
+    If `report` is None then return a context manager doing nothing.
+    """
+    return report.phase(name) if report is not None else nullcontext()
+
+class Report():
+    """A report of generating the target implementation of FSM `name`.
+
+    Memory allocations are traced from construction until :meth:`write`.
+    """
+    def __init__(self, name):
+        self.name = name
+        self.phases = []
+        self.stats = []
+        self._tracing = not tracemalloc.is_tracing()
+        if self._tracing:
+            tracemalloc.start()
+    @contextmanager
+    def phase(self, name):
+        """Return a context manager recording the phase `name`."""
+        tracemalloc.reset_peak()
+        start = perf_counter()
+        try:
+            yield self
+        finally:
+            self.phases.append((
+                name,
+                perf_counter() - start,
+                tracemalloc.get_traced_memory()[1],
+            ))
+    def stat(self, name, value):
+        """Record the statistic `name` with `value`."""
+        self.stats.append((name, value))
+    def ir_stats(self, ir):
+        """Record statistics of the intermediate representation `ir`.
+
+        See :meth:`rsk_fsm.build.Builder.get_ir`. The handler table bytes are of
+        one C function pointer for each event in each state, with the pointer
+        size of this host.
+        """
+        handlers = [
+            transitions for by_state in ir['transitions'].values()
+            for transitions in by_state.values()
+        ]
+        chains = [
+            sum(1 for step in transition['steps'] if 'state' in step)
+            for transitions in handlers + [[ir['initial_transition']]]
+            for transition in transitions
+        ]
+        self.stat('states', len(ir['states']))
+        self.stat('events', len(ir['events']))
+        self.stat('conditions', len(ir['conditions']))
+        self.stat('actions', len(ir['actions']))
+        self.stat('handlers', len(handlers))
+        self.stat('unique handler bodies', len({
+            json.dumps(_, sort_keys=True) for _ in handlers
+        }))
+        self.stat(
+            'handler table bytes',
+            len(ir['events']) * len(ir['states']) * TABLE_ENTRY_SIZE,
+        )
+        self.stat('longest exit/enter chain', max(chains))
+    def write(self, fp):
+        """Write this report to file object `fp` and stop tracing memory."""
+        if self._tracing:
+            tracemalloc.stop()
+            self._tracing = False
+        lines = [
+            f'{self.name}:',
+            f'  {"phase":<26}{"time (s)":>10}{"peak (KiB)":>12}',
+        ]
+        for (name, seconds, peak) in self.phases:
+            lines.append(f'  {name:<26}{seconds:>10.3f}{peak // 1024:>12}')
+        rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        for (name, value) in self.stats + [('max RSS (KiB)', rss)]:
+            lines.append(f'  {name:<26}{value:>10}')
+        fp.write('\n'.join(lines) + '\n')
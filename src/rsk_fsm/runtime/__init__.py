@@ -0,0 +1,21 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""The C runtime support shipped with rsk_fsm.
+
+The C sources in this package directory may be compiled and linked together
+with FSM implementations built by :mod:`rsk_fsm.target.c`:
+
+* rsk_fsm_executor.h, rsk_fsm_executor.c: a sharded, multi-threaded executor
+  for FSM instances built with the C target options --mailbox and --dispatch.
+* rsk_fsm_replay.h, rsk_fsm_replay.c: a replay of a memory-mapped binary event
+  log through sharded FSM instances, reporting throughput, state dwell times
+  and final states, for the driver built with the C target option --replay.
+
+Run this module to print the package directory, for use in a build system.
+"""
+
+import os
+
+def path():
+    """Return the directory containing the C runtime sources."""
+    return os.path.dirname(os.path.abspath(__file__))
@@ -0,0 +1,7 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Print the directory containing the C runtime sources."""
+
+from . import path
+
+print(path())
@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "rsk_fsm_executor.h"
+
+/* The state of an actor: not on a run queue; on a run queue or running; or
+ * running, with an event posted since it started receiving.
+ */
+enum {
+	IDLE,
+	SCHEDULED,
+	NOTIFIED,
+};
+
+/* Wake every worker sleeping in `executor`. */
+static void wake_all(rsk_fsm_executor_t * executor) {
+	pthread_mutex_lock(&executor->lock);
+	pthread_cond_broadcast(&executor->wake);
+	pthread_mutex_unlock(&executor->lock);
+}
+
+/* Count `handled` posted events as handled in `executor`, waking the sleeping
+ * workers to exit if they were the last whilst stopping.
+ */
+static void count_handled(rsk_fsm_executor_t * executor, long handled) {
+	if (handled && atomic_fetch_sub(&executor->outstanding, handled) == handled && atomic_load(&executor->stopping)) {
+		wake_all(executor);
+	}
+}
+
+/* Append `actor` to the run queue of `worker`, waking a sleeping worker. */
+static void enqueue(rsk_fsm_worker_t * worker, rsk_fsm_actor_t * actor) {
+	rsk_fsm_executor_t * executor = worker->executor;
+	pthread_mutex_lock(&worker->lock);
+	actor->next = 0;
+	if (worker->last) {
+		worker->last->next = actor;
+	} else {
+		worker->first = actor;
+	}
+	worker->last = actor;
+	pthread_mutex_unlock(&worker->lock);
+	/* a worker either sees the actor queued before sleeping, or is woken */
+	atomic_fetch_add(&executor->queued, 1);
+	if (atomic_load(&executor->sleeping)) {
+		pthread_mutex_lock(&executor->lock);
+		pthread_cond_signal(&executor->wake);
+		pthread_mutex_unlock(&executor->lock);
+	}
+}
+
+/* Remove and return the first actor in the run queue of `worker`, or NULL.
+ * `worker->lock` must be held.
+ */
+static rsk_fsm_actor_t * dequeue(rsk_fsm_worker_t * worker) {
+	rsk_fsm_actor_t * actor = worker->first;
+	if (actor) {
+		worker->first = actor->next;
+		if (!worker->first) {
+			worker->last = 0;
+		}
+		actor->next = 0;
+		atomic_fetch_sub(&worker->executor->queued, 1);
+	}
+	return actor;
+}
+
+/* Schedule `actor` after an event is posted to its mailbox.
+ *
+ * The state is always written, even if already notified, so that the worker
+ * which next starts receiving from the actor, or fails to make it idle, is
+ * ordered after the posted event.
+ */
+static void notify(rsk_fsm_actor_t * actor) {
+	rsk_fsm_executor_t * executor = actor->executor;
+	int state = atomic_load(&actor->state);
+	while (!atomic_compare_exchange_weak(&actor->state, &state, state == IDLE ? SCHEDULED : NOTIFIED)) {
+		/* retry with the current state */
+	}
+	if (state == IDLE) {
+		enqueue(&executor->workers[actor->shard % executor->num_workers], actor);
+	}
+}
+
+/* Handle up to a batch of events in the mailbox of `actor` on `worker`. */
+static void run(rsk_fsm_worker_t * worker, rsk_fsm_actor_t * actor) {
+	rsk_fsm_executor_t * executor = worker->executor;
+	int state = SCHEDULED;
+	unsigned handled;
+	/* an event posted from now on notifies the actor again */
+	atomic_exchange(&actor->state, SCHEDULED);
+	handled = actor->receive(actor->instance, executor->batch);
+	worker->dispatched += handled;
+	count_handled(executor, handled);
+	if (handled < executor->batch && atomic_compare_exchange_strong(&actor->state, &state, IDLE)) {
+		return;
+	}
+	/* a full batch, or notified whilst receiving: schedule the actor again */
+	enqueue(&executor->workers[actor->shard % executor->num_workers], actor);
+}
+
+/* Steal an actor from the run queue of another worker, or return NULL. */
+static rsk_fsm_actor_t * steal(rsk_fsm_worker_t * worker) {
+	rsk_fsm_executor_t * executor = worker->executor;
+	rsk_fsm_worker_t * victim;
+	rsk_fsm_actor_t * actor = 0;
+	unsigned index = worker - executor->workers;
+	unsigned offset;
+	for (offset = 1; !actor && offset < executor->num_workers; offset++) {
+		victim = &executor->workers[(index + offset) % executor->num_workers];
+		if (pthread_mutex_trylock(&victim->lock) == 0) {
+			actor = dequeue(victim);
+			pthread_mutex_unlock(&victim->lock);
+		}
+	}
+	if (actor) {
+		worker->stolen++;
+	}
+	return actor;
+}
+
+/* Sleep until an actor is queued on any worker or `executor` is stopped.
+ * Return non-zero if stopped with every posted event handled.
+ */
+static int wait_for_work(rsk_fsm_executor_t * executor) {
+	int stopped;
+	pthread_mutex_lock(&executor->lock);
+	atomic_fetch_add(&executor->sleeping, 1);
+	while (1) {
+		stopped = atomic_load(&executor->stopping) && !atomic_load(&executor->outstanding);
+		if (stopped || atomic_load(&executor->queued) > 0) {
+			break;
+		}
+		pthread_cond_wait(&executor->wake, &executor->lock);
+	}
+	atomic_fetch_sub(&executor->sleeping, 1);
+	pthread_mutex_unlock(&executor->lock);
+	return stopped;
+}
+
+/* The worker thread start routine. */
+static void * work(void * data) {
+	rsk_fsm_worker_t * worker = data;
+	rsk_fsm_executor_t * executor = worker->executor;
+	rsk_fsm_actor_t * actor;
+	while (1) {
+		pthread_mutex_lock(&worker->lock);
+		actor = dequeue(worker);
+		pthread_mutex_unlock(&worker->lock);
+		if (!actor) {
+			actor = steal(worker);
+		}
+		if (actor) {
+			run(worker, actor);
+		} else if (wait_for_work(executor)) {
+			return 0;
+		}
+	}
+}
+
+int rsk_fsm_executor_init(rsk_fsm_executor_t * executor, unsigned workers, unsigned batch) {
+	unsigned index;
+	if (!workers || !batch) {
+		errno = EINVAL;
+		return -1;
+	}
+	executor->workers = calloc(workers, sizeof(*executor->workers));
+	if (!executor->workers) {
+		return -1;
+	}
+	executor->num_workers = workers;
+	executor->batch = batch;
+	atomic_init(&executor->stopping, 0);
+	atomic_init(&executor->outstanding, 0);
+	atomic_init(&executor->queued, 0);
+	atomic_init(&executor->sleeping, 0);
+	pthread_mutex_init(&executor->lock, 0);
+	pthread_cond_init(&executor->wake, 0);
+	for (index = 0; index < workers; index++) {
+		executor->workers[index].executor = executor;
+		pthread_mutex_init(&executor->workers[index].lock, 0);
+	}
+	return 0;
+}
+
+int rsk_fsm_executor_start(rsk_fsm_executor_t * executor) {
+	unsigned index;
+	for (index = 0; index < executor->num_workers; index++) {
+		if (pthread_create(&executor->workers[index].thread, 0, work, &executor->workers[index])) {
+			/* stop the workers already started */
+			atomic_store(&executor->stopping, 1);
+			wake_all(executor);
+			while (index--) {
+				pthread_join(executor->workers[index].thread, 0);
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void rsk_fsm_executor_stop(rsk_fsm_executor_t * executor) {
+	unsigned index;
+	atomic_store(&executor->stopping, 1);
+	wake_all(executor);
+	for (index = 0; index < executor->num_workers; index++) {
+		pthread_join(executor->workers[index].thread, 0);
+	}
+}
+
+void rsk_fsm_executor_fini(rsk_fsm_executor_t * executor) {
+	unsigned index;
+	for (index = 0; index < executor->num_workers; index++) {
+		pthread_mutex_destroy(&executor->workers[index].lock);
+	}
+	pthread_mutex_destroy(&executor->lock);
+	pthread_cond_destroy(&executor->wake);
+	free(executor->workers);
+	executor->workers = 0;
+}
+
+void rsk_fsm_actor_init(rsk_fsm_actor_t * actor, rsk_fsm_executor_t * executor, unsigned shard, void * instance, rsk_fsm_post_fp post, rsk_fsm_receive_fp receive) {
+	actor->instance = instance;
+	actor->post = post;
+	actor->receive = receive;
+	actor->executor = executor;
+	actor->shard = shard;
+	atomic_init(&actor->state, IDLE);
+	actor->next = 0;
+}
+
+int rsk_fsm_post(rsk_fsm_actor_t * actor, int event, void * arg) {
+	/* count the event before a worker can handle it */
+	atomic_fetch_add(&actor->executor->outstanding, 1);
+	if (actor->post(actor->instance, event, arg)) {
+		count_handled(actor->executor, 1);
+		return -1;
+	}
+	notify(actor);
+	return 0;
+}
@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* A sharded, multi-threaded executor for FSM instances.
+ *
+ * Each FSM instance is wrapped in an actor: the instance's own lock-free
+ * mailbox, and the functions that post an event to it and receive a batch of
+ * posted events from it. Build the FSM implementation with the C target
+ * options --mailbox and --dispatch for suitable <prefix>_post and
+ * <prefix>_receive_batch functions.
+ *
+ * Each worker thread owns a shard of actors and a run queue of actors with
+ * events in their mailbox. A worker receives from one actor at a time. An
+ * idle worker steals a whole actor from the run queue of another worker, so
+ * that the events posted to an actor are always handled in the order in
+ * which they were posted, one at a time. A worker with nothing to run or
+ * steal sleeps until an actor is queued or the executor is stopped.
+ */
+
+#ifndef RSK_FSM_EXECUTOR_H
+#define RSK_FSM_EXECUTOR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef int (*rsk_fsm_post_fp)(void * instance, int event, void * arg);
+typedef unsigned (*rsk_fsm_receive_fp)(void * instance, unsigned batch);
+
+typedef struct rsk_fsm_actor_tag rsk_fsm_actor_t;
+typedef struct rsk_fsm_worker_tag rsk_fsm_worker_t;
+typedef struct rsk_fsm_executor_tag rsk_fsm_executor_t;
+
+struct rsk_fsm_actor_tag {
+	void * instance;
+	rsk_fsm_post_fp post;
+	rsk_fsm_receive_fp receive;
+	rsk_fsm_executor_t * executor;
+	unsigned shard;
+	atomic_int state;
+	rsk_fsm_actor_t * next;
+};
+
+struct rsk_fsm_worker_tag {
+	rsk_fsm_executor_t * executor;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	rsk_fsm_actor_t * first;
+	rsk_fsm_actor_t * last;
+	unsigned long dispatched;
+	unsigned long stolen;
+};
+
+struct rsk_fsm_executor_tag {
+	unsigned num_workers;
+	unsigned batch;
+	atomic_int stopping;
+	atomic_long outstanding;
+	atomic_long queued;
+	atomic_uint sleeping;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	rsk_fsm_worker_t * workers;
+};
+
+/* Initialise `executor` with `workers` threads, each handling at most `batch`
+ * events from an actor's mailbox before moving on to the next actor.
+ * Return 0 on success, or -1 on failure.
+ */
+extern int rsk_fsm_executor_init(rsk_fsm_executor_t * executor, unsigned workers, unsigned batch);
+/* Start the worker threads of `executor`. Return 0 on success, or -1. */
+extern int rsk_fsm_executor_start(rsk_fsm_executor_t * executor);
+/* Wait until every posted event is handled, then stop the worker threads. */
+extern void rsk_fsm_executor_stop(rsk_fsm_executor_t * executor);
+/* Release the resources of a stopped `executor`. */
+extern void rsk_fsm_executor_fini(rsk_fsm_executor_t * executor);
+
+/* Initialise `actor` for FSM `instance` in `shard` of `executor`, posting to
+ * and receiving from the instance's mailbox with `post` and `receive`. The FSM
+ * instance must already be initialised.
+ */
+extern void rsk_fsm_actor_init(rsk_fsm_actor_t * actor, rsk_fsm_executor_t * executor, unsigned shard, void * instance, rsk_fsm_post_fp post, rsk_fsm_receive_fp receive);
+
+/* Post `event` with `arg` to `actor`, from any thread.
+ * Return 0 on success, or -1 if the actor's mailbox is full or the event is
+ * out of range.
+ */
+extern int rsk_fsm_post(rsk_fsm_actor_t * actor, int event, void * arg);
+
+#endif
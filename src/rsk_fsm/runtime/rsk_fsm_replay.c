@@ -0,0 +1,396 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* for madvise and MADV_SEQUENTIAL when compiled with -std=c11 */
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rsk_fsm_replay.h"
+
+/* the size of a record with `size` bytes of event argument */
+#define RECORD_SIZE(size) (sizeof(rsk_fsm_record_t) + (((size_t) (size) + 7) & ~(size_t) 7))
+
+/* the time an instance not yet in the log was last in its state since */
+#define UNSEEN UINT64_MAX
+
+/* the assumed cache line size, separating the data written by each shard */
+#define CACHE_LINE 64
+
+typedef struct shard_tag shard_t;
+typedef struct worker_tag worker_t;
+
+/* A contiguous block of instances, with its own instance storage, the offsets
+ * of its records in the log, in log order, and its own results.
+ */
+struct shard_tag {
+	uint32_t first;
+	uint32_t count;
+	unsigned char * instances;
+	uint64_t * since;
+	size_t * offsets;
+	size_t records;
+	size_t dispatched;
+	size_t skipped;
+	uint64_t * dwell;
+	size_t * entries;
+};
+
+/* A thread replaying the shards `index`, `index + threads`, ... */
+struct worker_tag {
+	pthread_t thread;
+	unsigned index;
+	unsigned threads;
+	unsigned num_shards;
+	shard_t * shards;
+	const rsk_fsm_log_t * log;
+	const rsk_fsm_replay_fsm_t * fsm;
+};
+
+int rsk_fsm_log_open(rsk_fsm_log_t * log, const char * path) {
+	struct stat st;
+	size_t offset = 0;
+	const rsk_fsm_record_t * record;
+	int fd = open(path, O_RDONLY);
+	memset(log, 0, sizeof(*log));
+	if (fd < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	log->length = (size_t) st.st_size;
+	if (log->length) {
+		void * data = mmap(NULL, log->length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise(data, log->length, MADV_SEQUENTIAL);
+		log->data = data;
+	}
+	close(fd);
+	while (offset < log->length) {
+		record = (const rsk_fsm_record_t *) (log->data + offset);
+		if ((log->length - offset < sizeof(*record))
+				|| (log->length - offset < RECORD_SIZE(record->size))
+				|| (record->instance == UINT32_MAX)) {
+			rsk_fsm_log_close(log);
+			errno = EINVAL;
+			return -1;
+		}
+		if (!log->records || record->time < log->start) {
+			log->start = record->time;
+		}
+		if (record->time > log->end) {
+			log->end = record->time;
+		}
+		if (record->instance >= log->instances) {
+			log->instances = record->instance + 1;
+		}
+		log->records++;
+		offset += RECORD_SIZE(record->size);
+	}
+	return 0;
+}
+
+void rsk_fsm_log_close(rsk_fsm_log_t * log) {
+	if (log->data) {
+		munmap((void *) log->data, log->length);
+	}
+	memset(log, 0, sizeof(*log));
+}
+
+/* Replay the records of `shard`. */
+static void replay_shard(const worker_t * worker, shard_t * shard) {
+	const rsk_fsm_log_t * log = worker->log;
+	const rsk_fsm_replay_fsm_t * fsm = worker->fsm;
+	size_t dispatched = 0;
+	size_t skipped = 0;
+	size_t idx;
+	const rsk_fsm_record_t * record;
+	uint32_t number;
+	void * instance;
+	uint64_t * since;
+	int before;
+	int after;
+	for (idx = 0; idx < shard->records; idx++) {
+		record = (const rsk_fsm_record_t *) (log->data + shard->offsets[idx]);
+		if (record->event >= fsm->num_events) {
+			skipped++;
+			continue;
+		}
+		number = record->instance - shard->first;
+		instance = shard->instances + (size_t) number * fsm->size;
+		since = &shard->since[number];
+		if (*since == UNSEEN) {
+			*since = record->time;
+		}
+		before = fsm->state(instance);
+		fsm->dispatch(instance, record->event, record->size ? (const void *) (record + 1) : NULL);
+		after = fsm->state(instance);
+		if (after != before) {
+			if (before >= 0 && record->time > *since) {
+				shard->dwell[before] += record->time - *since;
+			}
+			if (after >= 0) {
+				shard->entries[after]++;
+			}
+			*since = record->time;
+		}
+		dispatched++;
+	}
+	shard->dispatched = dispatched;
+	shard->skipped = skipped;
+}
+
+/* Replay each shard of `data`, a worker. */
+static void * work(void * data) {
+	const worker_t * worker = data;
+	unsigned index;
+	for (index = worker->index; index < worker->num_shards; index += worker->threads) {
+		replay_shard(worker, &worker->shards[index]);
+	}
+	return NULL;
+}
+
+/* Return zeroed storage for `count` elements of `size` bytes, in whole cache
+ * lines, so that no other shard's data shares its cache lines, or NULL.
+ */
+static void * line_calloc(size_t count, size_t size) {
+	size_t length;
+	void * data;
+	if (size && count > (SIZE_MAX - CACHE_LINE) / size) {
+		return NULL;
+	}
+	length = (count * size + CACHE_LINE) & ~(size_t) (CACHE_LINE - 1);
+	data = aligned_alloc(CACHE_LINE, length);
+	if (data) {
+		memset(data, 0, length);
+	}
+	return data;
+}
+
+/* Release the resources of each of `num_shards` `shards`, then `shards`. */
+static void free_shards(shard_t * shards, unsigned num_shards) {
+	unsigned index;
+	if (!shards) {
+		return;
+	}
+	for (index = 0; index < num_shards; index++) {
+		free(shards[index].entries);
+		free(shards[index].dwell);
+		free(shards[index].offsets);
+		free(shards[index].since);
+		free(shards[index].instances);
+	}
+	free(shards);
+}
+
+/* Return `num_shards` shards of the instances in `log`, listing the records of
+ * each, or NULL on failure.
+ */
+static shard_t * new_shards(const rsk_fsm_log_t * log, const rsk_fsm_replay_fsm_t * fsm, unsigned num_shards) {
+	/* the number of instances in each shard but the last */
+	uint32_t block = (uint32_t) ((log->instances + (uint64_t) num_shards - 1) / num_shards);
+	shard_t * shards = calloc(num_shards, sizeof(shard_t));
+	const rsk_fsm_record_t * record;
+	size_t offset;
+	unsigned index;
+	uint32_t number;
+	shard_t * shard;
+	if (!shards) {
+		return NULL;
+	}
+	block = block ? block : 1;
+	for (offset = 0; offset < log->length; offset += RECORD_SIZE(record->size)) {
+		record = (const rsk_fsm_record_t *) (log->data + offset);
+		shards[record->instance / block].records++;
+	}
+	for (index = 0; index < num_shards; index++) {
+		shard = &shards[index];
+		shard->first = (uint32_t) ((uint64_t) index * block < log->instances ? (uint64_t) index * block : log->instances);
+		shard->count = (log->instances - shard->first < block) ? log->instances - shard->first : block;
+		shard->instances = line_calloc(shard->count, fsm->size);
+		shard->since = line_calloc(shard->count, sizeof(uint64_t));
+		shard->offsets = malloc((shard->records ? shard->records : 1) * sizeof(size_t));
+		shard->dwell = line_calloc(fsm->num_states, sizeof(uint64_t));
+		shard->entries = line_calloc(fsm->num_states, sizeof(size_t));
+		if (!shard->instances || !shard->since || !shard->offsets
+				|| !shard->dwell || !shard->entries) {
+			free_shards(shards, num_shards);
+			return NULL;
+		}
+		for (number = 0; number < shard->count; number++) {
+			fsm->init(shard->instances + (size_t) number * fsm->size, NULL);
+			shard->since[number] = UNSEEN;
+		}
+		shard->records = 0;
+	}
+	for (offset = 0; offset < log->length; offset += RECORD_SIZE(record->size)) {
+		record = (const rsk_fsm_record_t *) (log->data + offset);
+		shard = &shards[record->instance / block];
+		shard->offsets[shard->records++] = offset;
+	}
+	return shards;
+}
+
+int rsk_fsm_replay(rsk_fsm_replay_t * replay, const rsk_fsm_log_t * log, const rsk_fsm_replay_fsm_t * fsm, unsigned shards, unsigned threads) {
+	shard_t * blocks = NULL;
+	worker_t * workers = NULL;
+	struct timespec start, end;
+	unsigned index;
+	unsigned started = 0;
+	uint32_t number;
+	unsigned state;
+	int current;
+	shard_t * shard;
+	memset(replay, 0, sizeof(*replay));
+	if (!shards || !threads) {
+		errno = EINVAL;
+		return -1;
+	}
+	threads = threads < shards ? threads : shards;
+	replay->shards = shards;
+	replay->threads = threads;
+	replay->dwell = calloc(fsm->num_states, sizeof(uint64_t));
+	replay->entries = calloc(fsm->num_states, sizeof(size_t));
+	replay->finals = calloc(fsm->num_states + 1, sizeof(size_t));
+	workers = calloc(threads, sizeof(worker_t));
+	if (!replay->dwell || !replay->entries || !replay->finals || !workers) {
+		goto failed;
+	}
+	blocks = new_shards(log, fsm, shards);
+	if (!blocks) {
+		goto failed;
+	}
+	for (index = 0; index < threads; index++) {
+		workers[index].index = index;
+		workers[index].threads = threads;
+		workers[index].num_shards = shards;
+		workers[index].shards = blocks;
+		workers[index].log = log;
+		workers[index].fsm = fsm;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (threads == 1) {
+		work(&workers[0]);
+	} else {
+		for (started = 0; started < threads; started++) {
+			if (pthread_create(&workers[started].thread, NULL, work, &workers[started])) {
+				break;
+			}
+		}
+		for (index = 0; index < started; index++) {
+			pthread_join(workers[index].thread, NULL);
+		}
+		if (started < threads) {
+			goto failed;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	replay->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	for (index = 0; index < shards; index++) {
+		shard = &blocks[index];
+		replay->dispatched += shard->dispatched;
+		replay->skipped += shard->skipped;
+		for (state = 0; state < fsm->num_states; state++) {
+			replay->dwell[state] += shard->dwell[state];
+			replay->entries[state] += shard->entries[state];
+		}
+		/* an instance is in its state at the end of the log until the end */
+		for (number = 0; number < shard->count; number++) {
+			if (shard->since[number] == UNSEEN) {
+				continue;
+			}
+			current = fsm->state(shard->instances + (size_t) number * fsm->size);
+			if (current >= 0) {
+				replay->dwell[current] += log->end - shard->since[number];
+				replay->finals[current]++;
+			} else {
+				replay->finals[fsm->num_states]++;
+			}
+		}
+	}
+	free_shards(blocks, shards);
+	free(workers);
+	return 0;
+failed:
+	free_shards(blocks, shards);
+	free(workers);
+	rsk_fsm_replay_fini(replay);
+	return -1;
+}
+
+void rsk_fsm_replay_report(const rsk_fsm_replay_t * replay, const rsk_fsm_replay_fsm_t * fsm, FILE * fp) {
+	uint64_t total = 0;
+	unsigned state;
+	for (state = 0; state < fsm->num_states; state++) {
+		total += replay->dwell[state];
+	}
+	fprintf(fp, "records: %zu dispatched, %zu skipped\n", replay->dispatched, replay->skipped);
+	fprintf(fp, "shards: %u, threads: %u\n", replay->shards, replay->threads);
+	fprintf(fp, "time: %.3f s, %.0f records/s\n", replay->seconds,
+		replay->seconds > 0 ? replay->dispatched / replay->seconds : 0.0);
+	fprintf(fp, "%-24s %12s %20s %7s %12s\n", "state", "entries", "dwell", "dwell%", "final");
+	for (state = 0; state < fsm->num_states; state++) {
+		fprintf(fp, "%-24s %12zu %20llu %6.2f%% %12zu\n",
+			fsm->state_names[state],
+			replay->entries[state],
+			(unsigned long long) replay->dwell[state],
+			total ? 100.0 * replay->dwell[state] / total : 0.0,
+			replay->finals[state]);
+	}
+	fprintf(fp, "%-24s %12s %20s %7s %12zu\n", "(final)", "", "", "", replay->finals[fsm->num_states]);
+}
+
+void rsk_fsm_replay_fini(rsk_fsm_replay_t * replay) {
+	free(replay->finals);
+	free(replay->entries);
+	free(replay->dwell);
+	replay->finals = NULL;
+	replay->entries = NULL;
+	replay->dwell = NULL;
+}
+
+/* Return the positive number in string `arg`, or 0 if not a number. */
+static unsigned positive(const char * arg) {
+	char * end;
+	unsigned long value = strtoul(arg, &end, 10);
+	return (*arg && !*end && value <= 65536) ? (unsigned) value : 0;
+}
+
+int rsk_fsm_replay_main(int argc, char ** argv, const rsk_fsm_replay_fsm_t * fsm) {
+	rsk_fsm_log_t log;
+	rsk_fsm_replay_t replay;
+	unsigned shards = argc > 2 ? positive(argv[2]) : 1;
+	unsigned threads = argc > 3 ? positive(argv[3]) : 1;
+	if (argc < 2 || argc > 4 || !shards || !threads) {
+		fprintf(stderr, "usage: %s LOG [SHARDS [THREADS]]\n", argv[0]);
+		return 2;
+	}
+	if (rsk_fsm_log_open(&log, argv[1])) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (rsk_fsm_replay(&replay, &log, fsm, shards, threads)) {
+		perror("replay");
+		rsk_fsm_log_close(&log);
+		return 1;
+	}
+	fprintf(stdout, "log: %s, %zu records, %u instances, time %llu to %llu\n",
+		argv[1], log.records, log.instances,
+		(unsigned long long) log.start, (unsigned long long) log.end);
+	rsk_fsm_replay_report(&replay, fsm, stdout);
+	rsk_fsm_replay_fini(&replay);
+	rsk_fsm_log_close(&log);
+	return 0;
+}
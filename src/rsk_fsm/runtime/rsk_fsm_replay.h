@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* Replay a binary log of recorded events through FSM instances.
+ *
+ * A log is a sequence of records, each a record header followed by `size`
+ * bytes of event argument, padded with zero bytes to a multiple of 8 bytes.
+ * Each field is in host byte order. The event argument passed to the FSM is a
+ * pointer to the argument bytes, or NULL if `size` is zero: the log is mapped
+ * read-only, so the FSM must not write to the argument.
+ *
+ * The log is memory-mapped, not read. Instance numbers should be dense: an
+ * instance is initialised for each number up to the greatest in the log.
+ * Instances are divided between shards in contiguous blocks of instance
+ * numbers, each shard with its own instances. The log is scanned once to list
+ * the records of each shard, then the shards are divided between threads. The
+ * records for an instance are always dispatched in log order.
+ *
+ * Build the FSM implementation with the C target option --replay for a
+ * driver, or --dispatch for a suitable <prefix>_dispatch function.
+ */
+
+#ifndef RSK_FSM_REPLAY_H
+#define RSK_FSM_REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct rsk_fsm_record_tag rsk_fsm_record_t;
+typedef struct rsk_fsm_log_tag rsk_fsm_log_t;
+typedef struct rsk_fsm_replay_fsm_tag rsk_fsm_replay_fsm_t;
+typedef struct rsk_fsm_replay_tag rsk_fsm_replay_t;
+
+struct rsk_fsm_record_tag {
+	uint64_t time;
+	uint32_t instance;
+	uint16_t event;
+	uint16_t size;
+};
+
+struct rsk_fsm_log_tag {
+	const unsigned char * data;
+	size_t length;
+	size_t records;
+	uint32_t instances;
+	uint64_t start;
+	uint64_t end;
+};
+
+/* The FSM implementation to replay a log through. */
+struct rsk_fsm_replay_fsm_tag {
+	/* the size of an instance */
+	size_t size;
+	/* initialise `instance`, with event `arg` for the initial transition */
+	void (*init)(void * instance, void * arg);
+	/* inject `event` with read-only `arg` into `instance` */
+	void (*dispatch)(void * instance, int event, const void * arg);
+	/* return the state of `instance`, or -1 if in the final state */
+	int (*state)(const void * instance);
+	unsigned num_states;
+	unsigned num_events;
+	const char * const * state_names;
+};
+
+struct rsk_fsm_replay_tag {
+	unsigned shards;
+	unsigned threads;
+	/* the number of records dispatched, and skipped for an unknown event */
+	size_t dispatched;
+	size_t skipped;
+	/* the wall time of dispatching, in seconds */
+	double seconds;
+	/* for each state, the total log time instances spent in the state and
+	 * the number of times an instance entered it by an event
+	 */
+	uint64_t * dwell;
+	size_t * entries;
+	/* for each state, then the final state, the number of instances in the
+	 * state at the end of the log, counting only instances in the log
+	 */
+	size_t * finals;
+};
+
+/* Memory-map the log file at `path` into `log` and check its records.
+ * Return 0 on success, or -1 on failure, with errno set: EINVAL if the log is
+ * truncated or malformed, or a record has instance number UINT32_MAX.
+ */
+extern int rsk_fsm_log_open(rsk_fsm_log_t * log, const char * path);
+/* Unmap `log`. */
+extern void rsk_fsm_log_close(rsk_fsm_log_t * log);
+
+/* Replay `log` through instances of `fsm`, in `shards` instance shards on
+ * `threads` threads, recording the results in `replay`.
+ * Return 0 on success, or -1 on failure.
+ */
+extern int rsk_fsm_replay(rsk_fsm_replay_t * replay, const rsk_fsm_log_t * log, const rsk_fsm_replay_fsm_t * fsm, unsigned shards, unsigned threads);
+/* Write a report of `replay` through `fsm` to `fp`. */
+extern void rsk_fsm_replay_report(const rsk_fsm_replay_t * replay, const rsk_fsm_replay_fsm_t * fsm, FILE * fp);
+/* Release the resources of `replay`. */
+extern void rsk_fsm_replay_fini(rsk_fsm_replay_t * replay);
+
+/* Run a replay driver for `fsm` with command line arguments
+ * `LOG [SHARDS [THREADS]]`, writing its report to stdout.
+ * Return the exit status.
+ */
+extern int rsk_fsm_replay_main(int argc, char ** argv, const rsk_fsm_replay_fsm_t * fsm);
+
+#endif
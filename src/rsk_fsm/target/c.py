@@ -2,6 +2,11 @@
 
 """Build a C implementation of a FSM."""
 
+import os
+
+from copy import copy
+from io import StringIO
+
 from ..build import Builder as _Builder
 
 class Comment(): # pylint: disable=too-few-public-methods
@@ -36,7 +41,24 @@ class IfCondition(): # pylint: disable=too-few-public-methods
         return '\n'.join([
             'if (' + condition + ') {'
         ] + [
-            '\t' + str(s) for s in self.stmts
+            '\t' + l for s in self.stmts for l in str(s).split('\n')
+        ] + [
+            '}',
+        ])
+
+class WhileLoop(): # pylint: disable=too-few-public-methods
+    """C while statement.
+
+    Reference: K&R ANSI C Section A9.5
+    """
+    def __init__(self, expr, stmts):
+        self.expr = expr
+        self.stmts = stmts
+    def __str__(self):
+        return '\n'.join([
+            'while (' + self.expr + ') {'
+        ] + [
+            '\t' + l for s in self.stmts for l in str(s).split('\n')
         ] + [
             '}',
         ])
@@ -213,6 +235,8 @@ class Enum(Type):
     def __init__(self, prefix):
         super().__init__(prefix)
         self._labels = []
+        ### a mapping of label to the index of its first declaration
+        self._indices = {}
     @property
     def type_specifier(self):
         return f'enum {self._prefix}_tag'
@@ -231,7 +255,7 @@ class Enum(Type):
 
         Raise :class:`ValueError` if `label` is not a declared label.
         """
-        if label not in self._labels:
+        if label not in self._indices:
             raise ValueError(label)
         return f'{self._prefix.upper()}_{str(label).upper()}'
     @property
@@ -248,13 +272,18 @@ class Enum(Type):
         return f'NUM_{self._prefix.upper()}'
     def append(self, label):
         """Append `label` string to this instance's declared labels."""
+        self._indices.setdefault(label, len(self._labels))
         self._labels.append(label)
     def extend(self, labels):
         """Extend `labels` strings to this instance's declared labels."""
-        self._labels.extend(labels)
+        for label in labels:
+            self.append(label)
     def index(self, label):
         """Return the index of `label` in this instance's declared labels."""
-        return self._labels.index(label)
+        try:
+            return self._indices[label]
+        except KeyError:
+            raise ValueError(label) # pylint: disable=raise-missing-from
     @property
     def labels(self):
         """Yield all formatted label values for this instance.
@@ -351,14 +380,40 @@ class Function():
     @property
     def implementation(self):
         """Return the function implementation as a string."""
-        impl = self._storage_class + ' ' if self._storage_class else ''
-        impl += self._type.interface(self._identifier)
-        impl += ' {'
+        fid = StringIO()
+        self.write(fid)
+        return fid.getvalue()
+    def write(self, fp):
+        """Write the function implementation to file object `fp`."""
+        if self._storage_class:
+            fp.write(self._storage_class + ' ')
+        fp.write(self._type.interface(self._identifier) + ' {')
         for stmt in self._statements:
-            for subs in str(stmt).split('\n'):
-                impl += '\n\t' + subs
-        impl += '\n}'
-        return impl
+            fp.write('\n\t' + str(stmt).replace('\n', '\n\t'))
+        fp.write('\n}')
+    def render(self):
+        """Return this function rendered as a :class:`RenderedFunction`."""
+        return RenderedFunction(
+            self.identifier, self.prototype, self.implementation,
+        )
+
+class RenderedFunction():
+    """C functions already rendered as source text.
+
+    - `identifier` is a string
+    - `prototype` is the function prototype string
+    - `implementation` is the function implementation string
+
+    A rendered function is written as the :class:`Function` it was rendered
+    from, and is cheap to send between processes.
+    """
+    def __init__(self, identifier, prototype, implementation):
+        self.identifier = identifier
+        self.prototype = prototype
+        self.implementation = implementation
+    def write(self, fp):
+        """Write the function implementation to file object `fp`."""
+        fp.write(self.implementation)
 
 class Array():
     """C arrays.
@@ -369,15 +424,17 @@ class Array():
       (K&R ANSI C Section A4.1)
     - `dimension` is a value defining the number of elements in the array
     - `elements` is an iterable of the array element values
+    - `type_name` is an explicit string element type name
 
     Reference: K&R ANSI C Section A8.6.2, A8.7
     """
     def __init__(
             self, identifier, type_,
-            storage_class=None, dimension=None, elements=(),
+            storage_class=None, dimension=None, elements=(), type_name=None,
         ): # pylint: disable=too-many-arguments
         self._identifier = identifier
         self._type = type_
+        self._type_name = type_name if type_name else type_.typedef_name
         self._storage_class = storage_class
         self._dimension = dimension
         self._elements = list(elements)
@@ -394,22 +451,93 @@ class Array():
     @property
     def implementation(self):
         """Return the array implementation as a string."""
+        fid = StringIO()
+        self.write(fid)
+        return fid.getvalue()
+    def write(self, fp):
+        """Write the array implementation to file object `fp`."""
         dimension = str(self._dimension) if self._dimension else ''
-        impl = (self._storage_class + ' ') if self._storage_class else ''
-        impl += self._type.typedef_name + ' '
-        impl += self._identifier + '[' + dimension + '] = {'
+        if self._storage_class:
+            fp.write(self._storage_class + ' ')
+        fp.write(f'{self._type_name} {self._identifier}[{dimension}] = {{')
         for elem in self._elements:
-            impl += '\n\t' + elem + ','
-        impl += '\n};'
-        return impl
+            fp.write('\n\t' + elem + ',')
+        fp.write('\n};')
 
 class Implementation(): # pylint: disable=too-many-instance-attributes
     """An instance of this class is a FSM implemented in C.
 
     The string representation is the C header and source code implementation.
+
+    If `broadcast` then the implementation tracks the membership of each FSM
+    instance in an arena, with one intrusive list of instances per state, so
+    that an event can be broadcast to each instance in a given state.
+
+    If `queue` is non-zero then each FSM instance has a bounded event queue of
+    `queue` entries. An event injected while the instance is handling an event
+    (for example, by an action) is queued and handled after the current
+    transition completes. An event injected when the queue is full is discarded
+    and counted in the instance's `dropped` member.
+
+    If `mailbox` is non-zero then each FSM instance has a lock-free mailbox of
+    `mailbox` entries, which must be a power of two. Any thread may post an
+    event to the mailbox; the thread owning the instance drains the mailbox,
+    handling each posted event in the order it was posted.
+
+    If `dispatch` then the implementation has a function for injecting an event
+    by number. If both `mailbox` and `dispatch` then it also has functions for
+    posting an event by number and for receiving at most a batch of posted
+    events, as driven by the executor runtime (see :mod:`rsk_fsm.runtime`).
+
+    If `atomic` then the FSM instance state is atomic, so that several threads
+    may inject events into a shared instance. A transition which only changes
+    state commits with a compare-and-swap from the current state to the next
+    state. Any other transition locks the instance by swapping its state for a
+    locked encoding of it, then runs its conditions and actions, storing each
+    intermediate state locked as it goes, and unlocks the instance: such a
+    transition must not inject an event into the same instance. The
+    `<prefix>_state` function returns the decoded state of an instance, for
+    actions and concurrent readers. `atomic` cannot be combined with
+    `broadcast` or `queue`.
+
+    If `shards` is non-zero then the transition event handlers are divided
+    between `shards` separate C source files, each of which may be compiled
+    separately, or one file for each handler if there are fewer handlers.
+    Sharded handlers have external linkage and are declared in a private
+    implementation header. See :meth:`write_files`.
+
+    If `replay` then the implementation has a replay driver, a C source file
+    with a main function replaying a binary event log through instances of the
+    FSM with the replay runtime (see :mod:`rsk_fsm.runtime`). `replay` implies
+    `dispatch` and cannot be combined with `broadcast`. See :meth:`write_files`.
+
+    If either `broadcast` or `dispatch` then the state and event enumerations
+    are declared in the C header.
     """
-    def __init__(self, prefix): # pylint: disable=too-many-locals
+    def __init__( # pylint: disable=too-many-locals,too-many-statements
+            self, prefix,
+            broadcast=False, queue=0, mailbox=0, dispatch=False, atomic=False,
+            shards=0, replay=False,
+        ): # pylint: disable=too-many-arguments
+        if queue < 0:
+            raise ValueError(f'queue capacity {queue} is negative')
+        if mailbox < 0 or mailbox & (mailbox - 1):
+            raise ValueError(f'mailbox capacity {mailbox} is not a power of 2')
+        if atomic and (broadcast or queue):
+            raise ValueError('atomic state cannot be broadcast or queued')
+        if shards < 0:
+            raise ValueError(f'number of shards {shards} is negative')
+        if replay and broadcast:
+            raise ValueError('a replayed implementation cannot be broadcast')
+        dispatch = dispatch or replay
         self._prefix = prefix
+        self._broadcast = broadcast
+        self._queue = queue
+        self._mailbox = mailbox
+        self._dispatch = dispatch
+        self._atomic = atomic
+        self._shards = shards
+        self._replay = replay
         ### C types
         type_state = Enum('state')
         type_event = Enum('event')
@@ -417,30 +545,210 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
         type_action = FunctionType('action')
         type_fsm_cb = Struct(f'{prefix}_cb')
         type_fsm = Struct(prefix)
+        type_arena = Struct(f'{prefix}_arena')
+        type_queued = Struct(f'{prefix}_event')
+        type_mail = Struct(f'{prefix}_mail')
         type_init = FunctionType('init')
         type_inject = FunctionType('inject')
+        type_set_state = FunctionType('set_state')
+        type_arena_init = FunctionType('arena_init')
+        type_fini = FunctionType('fini')
+        type_broadcast = FunctionType('broadcast')
+        type_dispatch = FunctionType('dispatch')
+        type_drain = FunctionType('drain')
+        type_post = FunctionType('post', 'int')
+        type_poster = FunctionType('poster', 'int')
+        type_receive = FunctionType('receive', 'unsigned')
+        type_public_receive = FunctionType('public_receive', 'unsigned')
+        type_public_dispatch = FunctionType('dispatch')
+        type_public_post = FunctionType('public_post', 'int')
+        type_receive_batch = FunctionType('receive_batch', 'unsigned')
+        type_transit = FunctionType('transit')
+        type_get_state = FunctionType('get_state', 'int')
         ### C functions
         fn_init = Function(f'{prefix}_init', type_init)
         fn_not_handled = Function('not_handled', type_inject, 'static')
+        if shards:
+            fn_set_state = Function(f'{prefix}_set_state', type_set_state)
+        else:
+            fn_set_state = Function('set_state', type_set_state, 'static')
+        fn_arena_init = Function(f'{prefix}_arena_init', type_arena_init)
+        fn_fini = Function(f'{prefix}_fini', type_fini)
+        fn_broadcast = Function(f'{prefix}_broadcast', type_broadcast)
+        fn_dispatch = Function('dispatch', type_dispatch, 'static')
+        fn_drain = Function('drain', type_drain, 'static')
+        fn_post = Function('post', type_post, 'static')
+        fn_receive = Function('receive', type_receive, 'static')
+        fn_public_receive = Function(f'{prefix}_receive', type_public_receive)
+        fn_public_dispatch = Function(
+            f'{prefix}_dispatch', type_public_dispatch,
+        )
+        fn_public_post = Function(f'{prefix}_post', type_public_post)
+        fn_receive_batch = Function(
+            f'{prefix}_receive_batch', type_receive_batch,
+        )
+        fn_transit = Function('transit', type_transit, 'static')
+        fn_get_state = Function(f'{prefix}_state', type_get_state)
         ### complete all parts which do not depend upon FSM details
         decl_data = IndirectDeclarator('data')
         decl_arg = IndirectDeclarator('arg')
         ptr_fsm = type_fsm.pointer('fsm')
         ptr_fsm_cb = type_fsm_cb.pointer('cb')
-        var_state = type_state.variable('state', opaque=True)
+        if atomic:
+            var_state = Declarator('state', type_name='atomic_int')
+        else:
+            var_state = type_state.variable('state', opaque=True)
+        var_event = type_event.variable('event', opaque=True)
+        ptr_arena = type_arena.pointer('arena')
         ### complete types which do not depend upon FSM details
         type_condition.extend([ptr_fsm, decl_arg])
         type_action.extend([ptr_fsm, decl_arg])
         type_fsm.extend([ptr_fsm_cb, decl_data, var_state])
-        type_init.extend([ptr_fsm, ptr_fsm_cb, decl_data, decl_arg])
+        if broadcast:
+            type_fsm.extend([
+                ptr_arena,
+                type_fsm.pointer('next'),
+                Declarator('pprev', type_name=f'{type_fsm.typedef_name} **'),
+            ])
+            type_arena.append(
+                type_fsm.pointer(f'members[{type_state.num_values}]'),
+            )
+            type_init.extend([ptr_fsm, ptr_fsm_cb, decl_data, ptr_arena])
+        else:
+            type_init.extend([ptr_fsm, ptr_fsm_cb, decl_data])
+        if queue:
+            type_queued.extend([var_event, decl_arg])
+            type_fsm.extend([
+                Declarator('busy', type_name='int'),
+                Declarator('head', type_name='unsigned'),
+                Declarator('queued', type_name='unsigned'),
+                Declarator('dropped', type_name='unsigned'),
+                type_queued.variable(f'queue[{queue}]'),
+            ])
+        if mailbox:
+            type_mail.extend([
+                Declarator('sequence', type_name='atomic_size_t'),
+                var_event,
+                decl_arg,
+            ])
+            type_fsm.extend([
+                Declarator('mail_tail', type_name='_Alignas(64) atomic_size_t'),
+                Declarator('mail_head', type_name='_Alignas(64) size_t'),
+                type_mail.variable(f'mailbox[{mailbox}]'),
+            ])
+        type_init.append(decl_arg)
         type_inject.extend([ptr_fsm, decl_arg])
+        type_set_state.extend([ptr_fsm, Declarator('state', type_name='int')])
+        type_arena_init.append(ptr_arena)
+        type_fini.append(ptr_fsm)
+        type_broadcast.extend([
+            ptr_arena,
+            Declarator('state', type_name='int'),
+            Declarator('event', type_name='int'),
+            decl_arg,
+        ])
+        type_dispatch.extend([ptr_fsm, var_event, decl_arg])
+        type_drain.append(ptr_fsm)
+        type_post.extend([ptr_fsm, var_event, decl_arg])
+        type_poster.extend([ptr_fsm, decl_arg])
+        type_receive.extend([
+            ptr_fsm, Declarator('batch', type_name='unsigned'),
+        ])
+        type_public_receive.append(ptr_fsm)
+        type_public_dispatch.extend([
+            IndirectDeclarator('instance'), var_event, decl_arg,
+        ])
+        type_public_post.extend([
+            IndirectDeclarator('instance'), var_event, decl_arg,
+        ])
+        type_receive_batch.extend([
+            IndirectDeclarator('instance'),
+            Declarator('batch', type_name='unsigned'),
+        ])
+        type_get_state.append(
+            Declarator('fsm', type_name=f'const {type_fsm.typedef_name} *'),
+        )
+        type_transit.extend([
+            ptr_fsm,
+            Declarator('handlers', type_name=f'{type_inject.typedef_name} *'),
+            Declarator('commits', type_name='const int *'),
+            decl_arg,
+        ])
         ### add statements which do not depend upon FSM details
         fn_not_handled.append(Comment('empty'))
+        if mailbox:
+            fn_init.append('size_t mail;')
+        if atomic:
+            # locked in no state until the initial transition completes
+            fn_init.append(
+                'atomic_init(&fsm->state,'
+                f' {type_state.null_value} + NUM_STATE + 1);'
+            )
         for decl in type_fsm.members:
             param = fn_init.type_.parameter(decl)
             if param:
                 stmt = f'fsm->{decl.identifier} = {param.identifier};'
                 fn_init.append(stmt)
+        if broadcast:
+            fn_init.append('fsm->pprev = 0;')
+            self._define_arena_functions(
+                type_fsm, fn_set_state, fn_arena_init, fn_fini, fn_broadcast,
+                'dispatch(fsm, event, arg);' if queue else
+                'transition_on_event[event][fsm->state](fsm, arg);',
+            )
+        if queue:
+            fn_init.extend([
+                'fsm->busy = 1;',
+                'fsm->head = 0;',
+                'fsm->queued = 0;',
+                'fsm->dropped = 0;',
+            ])
+            self._define_queue_functions(type_queued, fn_dispatch, fn_drain)
+        if mailbox:
+            fn_init.extend([
+                'atomic_init(&fsm->mail_tail, 0);',
+                'fsm->mail_head = 0;',
+                f'for (mail = 0; mail < {mailbox}; mail++) {{',
+                '\tatomic_init(&fsm->mailbox[mail].sequence, mail);',
+                '}',
+            ])
+            self._define_mailbox_functions(type_mail, fn_post, fn_receive)
+            fn_public_receive.append('return receive(fsm, UINT_MAX);')
+        if dispatch:
+            fn_public_dispatch.append(f'{ptr_fsm} = instance;')
+            protect = '(0 <= event) && (event < NUM_EVENT)'
+            if queue:
+                fn_public_dispatch.append(
+                    IfCondition(protect, ['dispatch(fsm, event, arg);']),
+                )
+            elif atomic:
+                fn_public_dispatch.append(IfCondition(protect, [
+                    'transit(fsm, transition_on_event[event],'
+                    ' commit_on_event[event], arg);',
+                ]))
+            else:
+                fn_public_dispatch.append(IfCondition(
+                    f'{protect} && '
+                    '(0 <= fsm->state) && (fsm->state < NUM_STATE)',
+                    ['transition_on_event[event][fsm->state](fsm, arg);'],
+                ))
+        if dispatch and mailbox:
+            fn_public_post.extend([
+                f'{ptr_fsm} = instance;',
+                IfCondition(protect, ['return post(fsm, event, arg);']),
+                'return -1;',
+            ])
+            fn_receive_batch.extend([
+                f'{ptr_fsm} = instance;',
+                'return receive(fsm, batch);',
+            ])
+        if atomic:
+            self._define_transit_function(fn_transit)
+            fn_get_state.extend([
+                'int state = atomic_load_explicit(&fsm->state,'
+                ' memory_order_acquire);',
+                'return state < NUM_STATE ? state : state - NUM_STATE - 1;',
+            ])
         ### FSM types
         self._type_state = type_state
         self._type_event = type_event
@@ -448,17 +756,279 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
         self._type_action = type_action
         self._type_fsm_cb = type_fsm_cb
         self._type_fsm = type_fsm
+        self._type_arena = type_arena
+        self._type_queued = type_queued
+        self._type_mail = type_mail
+        self._type_poster = type_poster
         self._type_init = type_init
         self._type_inject = type_inject
         ### FSM functions
         self._fn_init = fn_init
         self._fn_not_handled = fn_not_handled
+        self._fn_set_state = fn_set_state
+        self._fn_arena_functions = [fn_arena_init, fn_fini, fn_broadcast]
+        self._fn_queue_functions = [fn_drain, fn_dispatch]
+        self._fn_post = fn_post
+        self._fn_receive = fn_receive
+        self._fn_public_receive = fn_public_receive
+        self._fn_event_posters = []
+        self._fn_public_dispatch = fn_public_dispatch
+        self._fn_public_post = fn_public_post
+        self._fn_receive_batch = fn_receive_batch
+        self._fn_transit = fn_transit
+        self._fn_get_state = fn_get_state
         self._fn_event_handlers = []
+        ### handlers to define as the source is written, see define_handlers
+        self._pending_handlers = iter(())
         self._arrays_event_handlers = []
+        self._arrays_event_commits = []
         self._fn_event_injectors = []
-    def declare_state(self, state):
-        """Declare `state` label in this FSM's state enumeration."""
+        ### FSM state hierarchy, a mapping of state label to parent label
+        self._state_parents = {}
+    @staticmethod
+    def _define_arena_functions(
+            type_fsm, fn_set_state, fn_arena_init, fn_fini, fn_broadcast,
+            inject,
+        ): # pylint: disable=too-many-arguments
+        """Add statements to the functions maintaining arena membership.
+
+        The arena holds an intrusive list of instances for each state. Each
+        instance is a member of the list for its current state, linked by its
+        `next` pointer and by `pprev`, the address of the pointer to it.
+        """
+        protect = '(0 <= state) && (state < NUM_STATE)'
+        fn_set_state.extend([
+            IfCondition('fsm->pprev && (fsm->state == state)', [
+                'return;',
+            ]),
+            IfCondition('fsm->pprev', [
+                '*fsm->pprev = fsm->next;',
+                IfCondition('fsm->next', ['fsm->next->pprev = fsm->pprev;']),
+                'fsm->pprev = 0;',
+            ]),
+            'fsm->state = state;',
+            IfCondition(protect, [
+                'fsm->pprev = &fsm->arena->members[state];',
+                'fsm->next = *fsm->pprev;',
+                IfCondition('fsm->next', ['fsm->next->pprev = &fsm->next;']),
+                '*fsm->pprev = fsm;',
+            ]),
+        ])
+        fn_arena_init.extend([
+            'int state;',
+            'for (state = 0; state < NUM_STATE; state++) {',
+            '\tarena->members[state] = 0;',
+            '}',
+        ])
+        fn_fini.append(f'{fn_set_state.identifier}(fsm, INVALID_STATE);')
+        fn_broadcast.extend([
+            f'{type_fsm.pointer("pending")} = 0;',
+            f'{type_fsm.pointer("fsm")};',
+            'const state_e * member;',
+            IfCondition(
+                f'{protect} && (0 <= event) && (event < NUM_EVENT)',
+                ['return;'],
+                False,
+            ),
+            Comment('move instances in `state` and its substates to pending'),
+            'member = &broadcast_states[broadcast_offset[state]];',
+            WhileLoop('*member != INVALID_STATE', [
+                'fsm = arena->members[*member];',
+                IfCondition('fsm', [
+                    WhileLoop('fsm->next', ['fsm = fsm->next;']),
+                    'fsm->next = pending;',
+                    IfCondition('pending', ['pending->pprev = &fsm->next;']),
+                    'pending = arena->members[*member];',
+                    'pending->pprev = &pending;',
+                    'arena->members[*member] = 0;',
+                ]),
+                'member++;',
+            ]),
+            Comment('return each pending instance to its state, then inject'),
+            WhileLoop('pending', [
+                'fsm = pending;',
+                'pending = fsm->next;',
+                IfCondition('pending', ['pending->pprev = &pending;']),
+                'fsm->pprev = 0;',
+                f'{fn_set_state.identifier}(fsm, fsm->state);',
+                inject,
+            ]),
+        ])
+    def _define_queue_functions(self, type_queued, fn_dispatch, fn_drain):
+        """Add statements to the functions for run-to-completion handling.
+
+        The queue is a ring of `queue` entries starting at index `head`, of
+        which `queued` entries are in use. An instance is `busy` while handling
+        an event: events injected whilst busy are queued rather than handled.
+        """
+        capacity = self._queue
+        protect = '(0 <= fsm->state) && (fsm->state < NUM_STATE)'
+        handle = 'transition_on_event[event][fsm->state](fsm, arg);'
+        fn_drain.extend([
+            f'{type_queued.pointer("entry")};',
+            'int event;',
+            'void * arg;',
+            WhileLoop('fsm->queued', [
+                'entry = &fsm->queue[fsm->head];',
+                'event = entry->event;',
+                'arg = entry->arg;',
+                f'fsm->head = (fsm->head + 1) % {capacity};',
+                'fsm->queued--;',
+                IfCondition(protect, [handle]),
+            ]),
+            'fsm->busy = 0;',
+        ])
+        fn_dispatch.extend([
+            f'{type_queued.pointer("entry")};',
+            IfCondition('fsm->busy', [
+                IfCondition(f'fsm->queued == {capacity}', [
+                    'fsm->dropped++;',
+                    'return;',
+                ]),
+                f'entry = &fsm->queue[(fsm->head + fsm->queued) % {capacity}];',
+                'entry->event = event;',
+                'entry->arg = arg;',
+                'fsm->queued++;',
+                'return;',
+            ]),
+            'fsm->busy = 1;',
+            IfCondition(protect, [handle]),
+            'drain(fsm);',
+        ])
+    def _define_mailbox_functions(self, type_mail, fn_post, fn_receive):
+        """Add statements to the functions posting to and draining a mailbox.
+
+        The mailbox is a bounded multi-producer, single-consumer ring: each
+        entry has a sequence number which producers and the consumer use to
+        claim and release the entry (D. Vyukov's bounded queue algorithm).
+        Producers claim entries by advancing `mail_tail`; the consumer, the
+        owner of the FSM instance, receives at most `batch` entries at a time by
+        advancing `mail_head`.
+        """
+        capacity = self._mailbox
+        relaxed = 'memory_order_relaxed'
+        fn_post.extend([
+            f'{type_mail.pointer("mail")};',
+            f'size_t tail = atomic_load_explicit(&fsm->mail_tail, {relaxed});',
+            'size_t sequence;',
+            WhileLoop('1', [
+                f'mail = &fsm->mailbox[tail % {capacity}];',
+                'sequence = atomic_load_explicit('
+                '&mail->sequence, memory_order_acquire);',
+                IfCondition('sequence == tail', [
+                    IfCondition(
+                        'atomic_compare_exchange_weak_explicit('
+                        '&fsm->mail_tail, &tail, tail + 1,'
+                        f' {relaxed}, {relaxed})',
+                        ['break;'],
+                    ),
+                    'continue;',
+                ]),
+                IfCondition('(ptrdiff_t)(sequence - tail) < 0', [
+                    Comment('full'),
+                    'return -1;',
+                ]),
+                f'tail = atomic_load_explicit(&fsm->mail_tail, {relaxed});',
+            ]),
+            'mail->event = event;',
+            'mail->arg = arg;',
+            'atomic_store_explicit('
+            '&mail->sequence, tail + 1, memory_order_release);',
+            'return 0;',
+        ])
+        if self._queue:
+            handle = ['dispatch(fsm, event, arg);']
+        elif self._atomic:
+            handle = [
+                'transit(fsm, transition_on_event[event],'
+                ' commit_on_event[event], arg);',
+            ]
+        else:
+            handle = [IfCondition(
+                '(0 <= fsm->state) && (fsm->state < NUM_STATE)',
+                ['transition_on_event[event][fsm->state](fsm, arg);'],
+            )]
+        fn_receive.extend([
+            f'{type_mail.pointer("mail")};',
+            'int event;',
+            'void * arg;',
+            'unsigned received = 0;',
+            WhileLoop('received < batch', [
+                f'mail = &fsm->mailbox[fsm->mail_head % {capacity}];',
+                IfCondition(
+                    'atomic_load_explicit('
+                    '&mail->sequence, memory_order_acquire)'
+                    ' != fsm->mail_head + 1',
+                    [Comment('empty'), 'return received;'],
+                ),
+                'event = mail->event;',
+                'arg = mail->arg;',
+                'atomic_store_explicit(&mail->sequence,'
+                f' fsm->mail_head + {capacity}, memory_order_release);',
+                'fsm->mail_head++;',
+            ] + handle + [
+                'received++;',
+            ]),
+            'return received;',
+        ])
+    @staticmethod
+    def _define_transit_function(fn_transit):
+        """Add statements to the function transiting an atomic state.
+
+        For each state, `handlers` holds the transition event handler and
+        `commits` holds the next state of a transition which only changes state,
+        the state itself if the event is not handled, or the number of states if
+        the handler must run with the instance locked. A locked instance has
+        state value `state + NUM_STATE + 1`, at least NUM_STATE for any state
+        including the final state; the handler stores each intermediate state
+        locked, then unlocks the instance by subtracting `NUM_STATE + 1`.
+        """
+        acquire = 'memory_order_acquire'
+        acq_rel = 'memory_order_acq_rel'
+        fn_transit.extend([
+            f'int state = atomic_load_explicit(&fsm->state, {acquire});',
+            WhileLoop('1', [
+                IfCondition('state >= NUM_STATE', [
+                    Comment('locked by a transition in progress'),
+                    '#if defined(__x86_64__) || defined(__i386__)',
+                    '__builtin_ia32_pause();',
+                    '#elif defined(__aarch64__) || defined(__arm__)',
+                    '__asm__ __volatile__("yield");',
+                    '#endif',
+                    f'state = atomic_load_explicit(&fsm->state, {acquire});',
+                    'continue;',
+                ]),
+                IfCondition(
+                    '(0 <= state) && (state < NUM_STATE)', ['return;'], False,
+                ),
+                IfCondition('commits[state] == state', [
+                    Comment('nothing to commit'),
+                    'return;',
+                ]),
+                IfCondition('commits[state] != NUM_STATE', [
+                    Comment('commit a state change without locking'),
+                    IfCondition(
+                        'atomic_compare_exchange_weak_explicit(&fsm->state,'
+                        f' &state, commits[state], {acq_rel}, {acquire})',
+                        ['return;'],
+                    ),
+                    'continue;',
+                ]),
+                IfCondition(
+                    'atomic_compare_exchange_weak_explicit(&fsm->state,'
+                    f' &state, state + NUM_STATE + 1, {acq_rel}, {acquire})',
+                    ['handlers[state](fsm, arg);', 'return;'],
+                ),
+            ]),
+        ])
+    def declare_state(self, state, parent=None):
+        """Declare `state` label in this FSM's state enumeration.
+
+        `parent` is the label of the parent state of `state`, or None if
+        `state` is a root state of the FSM.
+        """
         self._type_state.append(state)
+        self._state_parents[state] = parent
     def declare_event(self, event):
         """Declare `event` name in this FSM's event enumeration.
 
@@ -473,13 +1043,32 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
         dimension = self._type_state.num_values
         array = Array(arr_name, self._type_inject, 'static', dimension)
         self._arrays_event_handlers.append(array)
+        if self._atomic:
+            commits = Array(
+                f'commit_on_event_{event}', None, 'static const', dimension,
+                type_name='int',
+            )
+            self._arrays_event_commits.append(commits)
         ### create function
         fn_name = f'{self._prefix}_inject_{event}'
         injector = Function(fn_name, self._type_inject)
-        protect = f'(0 <= fsm->state) && (fsm->state < {dimension})'
-        inject = f'{array.identifier}[fsm->state](fsm, arg);'
-        injector.append(IfCondition(protect, [inject]))
+        if self._queue:
+            label = self._type_event.label_value(event)
+            injector.append(f'dispatch(fsm, {label}, arg);')
+        elif self._atomic:
+            injector.append(
+                f'transit(fsm, {array.identifier}, {commits.identifier}, arg);'
+            )
+        else:
+            protect = f'(0 <= fsm->state) && (fsm->state < {dimension})'
+            inject = f'{array.identifier}[fsm->state](fsm, arg);'
+            injector.append(IfCondition(protect, [inject]))
         self._fn_event_injectors.append(injector)
+        if self._mailbox:
+            poster = Function(f'{self._prefix}_post_{event}', self._type_poster)
+            label = self._type_event.label_value(event)
+            poster.append(f'return post(fsm, {label}, arg);')
+            self._fn_event_posters.append(poster)
     def declare_condition(self, condition):
         """Declare `condition` name as a callback function for this FSM."""
         fn_name = f'condition_{condition}'
@@ -513,13 +1102,34 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
                 label = self._type_state.label_value(next_state)
             else:
                 label = self._type_state.null_value
-            stmts.append(f'fsm->state = {label};')
+            stmts.append(self._state_store(label))
         return stmts
+    def _state_store(self, label):
+        """Return a C statement setting the FSM state to state `label`."""
+        if self._broadcast:
+            return f'{self._fn_set_state.identifier}(fsm, {label});'
+        if self._atomic:
+            return (
+                f'atomic_store_explicit(&fsm->state, {label} + NUM_STATE + 1,'
+                ' memory_order_release);'
+            )
+        return f'fsm->state = {label};'
+    @property
+    def _state_commit(self):
+        """Return a C statement unlocking the atomic FSM state."""
+        return (
+            'atomic_fetch_sub_explicit(&fsm->state, NUM_STATE + 1,'
+            ' memory_order_release);'
+        )
     def define_init_handler(self, transition):
         """Extend the FSM init function with the initial `transition` steps."""
         stmts = []
         for step in transition['steps']:
             stmts += self._step_to_statements(step)
+        if self._queue:
+            stmts.append('drain(fsm);')
+        if self._atomic:
+            stmts.append(self._state_commit)
         self._fn_init.extend(stmts)
     def define_handler(self, event, state, transitions):
         """Define the handler function for handling `event` in `state`.
@@ -527,6 +1137,19 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
         If `transitions` does not define steps for handling `event` in `state`,
         then register the unhandled event function. Otherwise, create and
         register a new function implementing the transition steps.
+
+        If the FSM state is atomic then also register the transition commit.
+        """
+        self.add_handler(
+            event, state, transitions,
+            self.new_handler(event, state, transitions),
+        )
+    def new_handler(self, event, state, transitions):
+        """Return a function implementing `transitions` on `event` in `state`.
+
+        Return None if `transitions` does not define steps for handling `event`
+        in `state`. This does not change this implementation, so may be called
+        in a worker process.
         """
         stmts = []
         for transition in transitions:
@@ -536,99 +1159,628 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
             condition = transition['condition']
             if condition:
                 c_expr = f'fsm->cb->condition_{condition}(fsm, arg)'
+                if self._atomic:
+                    block.append(self._state_commit)
                 block.append('return;')
                 taken = transition['taken']
                 stmts.append(IfCondition(c_expr, block, taken))
             else:
                 stmts += block
-        if stmts:
-            name = f'handle_{event}_in_{state}'
-            handler = Function(name, self._type_inject, 'static', stmts)
+        if not stmts:
+            return None
+        if self._atomic:
+            stmts.append(self._state_commit)
+        name = f'handle_{event}_in_{state}'
+        if self._shards:
+            return Function(
+                f'{self._prefix}_{name}', self._type_inject, None, stmts,
+            )
+        return Function(name, self._type_inject, 'static', stmts)
+    def add_handler(self, event, state, transitions, handler):
+        """Register `handler` for handling `event` in `state`.
+
+        `handler` is the result of :meth:`new_handler` for `transitions`, or
+        its :class:`RenderedFunction`. If `handler` is None then register the
+        unhandled event function.
+        """
+        if self._atomic:
+            self._define_commit(event, state, transitions)
+        if handler is not None:
             self._fn_event_handlers.append(handler)
             fn_identifier = handler.identifier
         else:
             fn_identifier = self._fn_not_handled.identifier
         array = self._arrays_event_handlers[self._type_event.index(event)]
         array.append(fn_identifier)
+    def define_handlers(self, handlers, defer=True):
+        """Define handler functions from iterable `handlers` when written.
+
+        `handlers` yields the (event, state, transitions, handler) arguments of
+        :meth:`add_handler`, for each event in each state, in order. If `defer`
+        it is not iterated until the source is written, so that each handler
+        is written as soon as it is generated, rather than after all of them
+        are. Otherwise all the handlers are defined now.
+        """
+        self._pending_handlers = iter(handlers)
+        if not defer:
+            self._define_all_handlers()
+    def _define_pending_handlers(self):
+        """Define each handler pending from :meth:`define_handlers`.
+
+        Yield each handler function defined.
+        """
+        for (event, state, transitions, handler) in self._pending_handlers:
+            self.add_handler(event, state, transitions, handler)
+            if handler is not None:
+                yield handler
+    def _define_all_handlers(self):
+        """Define all handlers pending from :meth:`define_handlers`."""
+        for _ in self._define_pending_handlers():
+            pass
+    def _define_commit(self, event, state, transitions):
+        """Define the commit for handling `event` in `state`.
+
+        A transition with no condition and no actions commits its next state
+        without locking; the commit for an unhandled event is `state` itself.
+        """
+        commit = self._type_state.label_value(state)
+        if transitions:
+            (transition, *others) = transitions
+            if others or transition['condition'] or any(
+                    step.get('actions') for step in transition['steps']
+                ):
+                commit = self._type_state.num_values
+            for step in transition['steps']:
+                if commit != self._type_state.num_values and 'state' in step:
+                    if step['state']:
+                        commit = self._type_state.label_value(step['state'])
+                    else:
+                        commit = self._type_state.null_value
+        array = self._arrays_event_commits[self._type_event.index(event)]
+        array.append(commit)
     @property
     def eof(self):
         """Return a single line end-of-file comment."""
         return str(Comment('EOF'))
     @property
+    def _public_enums(self):
+        """Return True if the enumerations are declared in the C header."""
+        return self._broadcast or self._dispatch
+    @property
+    def _enums(self):
+        """Return a list of lines declaring the state and event enumerations."""
+        return [
+            self._type_state.typedef,
+            self._type_event.typedef,
+            '',
+            self._type_state.declaration,
+            '',
+            self._type_event.declaration,
+            '',
+        ]
+    @property
+    def _array_dispatch(self):
+        """Return the event dispatch array.
+
+        The event dispatch array indexes the transition event handler arrays by
+        event.
+        """
+        return Array(
+            'transition_on_event', None, 'static',
+            self._type_event.num_values,
+            [array.identifier for array in self._arrays_event_handlers],
+            f'{self._type_inject.typedef_name} *',
+        )
+    @property
+    def _array_commit_dispatch(self):
+        """Return the event commit dispatch array.
+
+        The event commit dispatch array indexes the transition commit arrays by
+        event.
+        """
+        return Array(
+            'commit_on_event', None, 'static const',
+            self._type_event.num_values,
+            [array.identifier for array in self._arrays_event_commits],
+            'int * const',
+        )
+    @property
+    def _arrays_broadcast(self):
+        """Return a list of arrays supporting broadcasting an event.
+
+        The broadcast state array holds, for each state, the state and its
+        substates terminated by the null value. The broadcast offset array holds
+        the offset of each state's list in the broadcast state array.
+        """
+        substates = {state: [] for state in self._state_parents}
+        for state in self._state_parents:
+            ancestor = state
+            while ancestor:
+                substates[ancestor].append(state)
+                ancestor = self._state_parents[ancestor]
+        members = Array(
+            'broadcast_states', self._type_state, 'static const',
+        )
+        offsets = Array(
+            'broadcast_offset', None, 'static const',
+            self._type_state.num_values, type_name='int',
+        )
+        offset = 0
+        for labels in substates.values():
+            offsets.append(str(offset))
+            members.extend([self._type_state.label_value(_) for _ in labels])
+            members.append(self._type_state.null_value)
+            offset += len(labels) + 1
+        return [members, offsets]
+    @property
     def header(self):
         """Return the C header implementation of this FSM as a string."""
-        return '\n'.join([
+        lines = []
+        if self._mailbox:
+            lines.append('#include <limits.h>')
+        if self._mailbox or self._atomic:
+            lines.append('#include <stdatomic.h>')
+        if self._mailbox:
+            lines.append('#include <stddef.h>')
+        if self._mailbox or self._atomic:
+            lines.append('')
+        lines += [
             self._type_fsm.typedef,
             self._type_fsm_cb.typedef,
+        ]
+        if self._broadcast:
+            lines.append(self._type_arena.typedef)
+        if self._queue:
+            lines.append(self._type_queued.typedef)
+        if self._mailbox:
+            lines.append(self._type_mail.typedef)
+        lines += [
             '',
             self._type_condition.typedef,
             self._type_action.typedef,
             '',
+        ]
+        if self._public_enums:
+            lines += self._enums
+        lines += [
             self._type_fsm_cb.declaration,
             '',
+        ]
+        if self._broadcast:
+            lines += [
+                self._type_arena.declaration,
+                '',
+            ]
+        if self._queue:
+            lines += [
+                self._type_queued.declaration,
+                '',
+            ]
+        if self._mailbox:
+            lines += [
+                self._type_mail.declaration,
+                '',
+            ]
+        lines += [
             self._type_fsm.declaration,
             '',
             self._fn_init.prototype,
         ] + [
             fn.prototype for fn in self._fn_event_injectors
-        ] + [
+        ]
+        if self._mailbox:
+            lines += [fn.prototype for fn in self._fn_event_posters]
+            lines.append(self._fn_public_receive.prototype)
+        if self._dispatch:
+            lines.append(self._fn_public_dispatch.prototype)
+        if self._dispatch and self._mailbox:
+            lines += [
+                self._fn_public_post.prototype,
+                self._fn_receive_batch.prototype,
+            ]
+        if self._atomic:
+            lines.append(self._fn_get_state.prototype)
+        if self._broadcast:
+            lines += [fn.prototype for fn in self._fn_arena_functions]
+        lines += [
             '',
             self.eof,
-        ])
+        ]
+        return '\n'.join(lines)
+    def _source_parts(self):
+        """Yield each of the parts of the C source implementation.
+
+        Each part is either a string or an object with a `write` method. Each
+        pending handler is defined, and yielded if not sharded, in turn.
+        """
+        lines = [] if self._public_enums or self._shards else self._enums
+        if not self._shards:
+            lines += [
+                self._type_inject.typedef,
+                '',
+            ]
+        lines += [
+            self._fn_not_handled,
+            '',
+        ]
+        if self._broadcast:
+            lines += [
+                self._fn_set_state,
+                '',
+            ]
+        if self._shards:
+            self._define_all_handlers()
+        else:
+            lines += self._fn_event_handlers
+        yield from lines
+        # the handler arrays are complete once each handler is defined
+        yield from self._define_pending_handlers()
+        lines = [
+            '',
+        ] + self._arrays_event_handlers
+        if self._atomic:
+            lines += self._arrays_event_commits
+        if self._broadcast or self._queue or self._mailbox or self._dispatch:
+            lines.append(self._array_dispatch)
+        if self._atomic:
+            if self._mailbox or self._dispatch:
+                lines.append(self._array_commit_dispatch)
+            lines.append(self._fn_transit)
+        if self._broadcast:
+            lines += self._arrays_broadcast
+        if self._queue:
+            lines += self._fn_queue_functions
+        if self._mailbox:
+            lines += [
+                self._fn_post,
+                self._fn_receive,
+            ]
+        lines += [
+            '',
+            self._fn_init,
+        ] + self._fn_event_injectors
+        if self._mailbox:
+            lines += self._fn_event_posters
+            lines.append(self._fn_public_receive)
+        if self._dispatch:
+            lines.append(self._fn_public_dispatch)
+        if self._dispatch and self._mailbox:
+            lines += [
+                self._fn_public_post,
+                self._fn_receive_batch,
+            ]
+        if self._atomic:
+            lines.append(self._fn_get_state)
+        if self._broadcast:
+            lines += self._fn_arena_functions
+        lines += [
+            '',
+            self.eof,
+        ]
+        yield from lines
     @property
     def source(self):
         """Return the C source implementation of this FSM as a string."""
-        return '\n'.join([
-            self._type_state.typedef,
-            self._type_event.typedef,
+        fid = StringIO()
+        self.write_source(fid)
+        return fid.getvalue()
+    def write_header(self, fp):
+        """Write the C header implementation of this FSM to file object `fp`."""
+        fp.write(self.header)
+    def write_source(self, fp):
+        """Write the C source implementation of this FSM to file object `fp`.
+
+        Functions and arrays are written in turn, so that the source is never
+        held in memory as a single string, and each pending handler is written
+        as it is generated.
+        """
+        for (index, part) in enumerate(self._source_parts()):
+            if index:
+                fp.write('\n')
+            if isinstance(part, str):
+                fp.write(part)
+            else:
+                part.write(fp)
+    def write(self, fp):
+        """Write the C header and C source implementations to file object `fp`.
+        """
+        if self._shards:
+            raise ValueError(
+                'a sharded implementation must be written to files'
+            )
+        if self._replay:
+            raise ValueError('a replay driver must be written to files')
+        self.write_header(fp)
+        fp.write('\n')
+        self.write_source(fp)
+    @property
+    def _impl_header(self):
+        """Return the private C implementation header for a sharded FSM.
+
+        The header is guarded against being included more than once.
+        """
+        self._define_all_handlers()
+        guard = f'{self._prefix.upper()}_IMPL_H'
+        lines = [
+            f'#ifndef {guard}',
+            f'#define {guard}',
             '',
-            self._type_state.declaration,
+        ]
+        if not self._public_enums:
+            lines += self._enums
+        lines += [
+            self._type_inject.typedef,
             '',
-            self._type_event.declaration,
+        ]
+        if self._broadcast:
+            lines.append(self._fn_set_state.prototype)
+        lines += [fn.prototype for fn in self._fn_event_handlers] + [
             '',
-            self._type_inject.typedef,
+            '#endif',
             '',
-            self._fn_not_handled.implementation,
+            self.eof,
+        ]
+        return '\n'.join(lines)
+    def _shard_handlers(self):
+        """Yield the list of transition event handlers for each shard.
+
+        Divide the handlers as evenly as possible between at most one shard
+        for each handler, so that no shard is empty unless there are no
+        handlers.
+        """
+        self._define_all_handlers()
+        handlers = self._fn_event_handlers
+        shards = max(1, min(self._shards, len(handlers)))
+        for index in range(shards):
+            yield handlers[
+                index * len(handlers) // shards:
+                (index + 1) * len(handlers) // shards
+            ]
+    @property
+    def _replay_parts(self):
+        """Return a list of the parts of the C replay driver source.
+
+        Each part is either a string or an object with a `write` method. By
+        default each condition of the replayed instances is false and each
+        action does nothing. With GCC or Clang the default callbacks are a weak
+        definition, which a definition linked with the driver overrides; with
+        any compiler, defining REPLAY_EXTERN_CB omits the default callbacks, so
+        that they must be linked with the driver. The event argument is the
+        read-only log: the callbacks must not write to it.
+        """
+        type_fsm = self._type_fsm.typedef_name
+        type_cb = self._type_fsm_cb.typedef_name
+        fn_condition = Function(
+            'replay_condition', self._type_condition, 'static',
+            ['return 0;'],
+        )
+        fn_action = Function(
+            'replay_action', self._type_action, 'static',
+            [Comment('empty')],
+        )
+        callbacks = [
+            '#if defined(__GNUC__)',
+            '__attribute__((weak))',
+            '#endif',
+            f'{type_cb} {self._prefix}_replay_cb = {{',
+        ]
+        for member in self._type_fsm_cb.members:
+            if member.identifier.startswith('condition_'):
+                callbacks.append(f'\t.{member.identifier} = replay_condition,')
+            else:
+                callbacks.append(f'\t.{member.identifier} = replay_action,')
+        callbacks += [
+            '};',
+            '#else',
+            f'extern {type_cb} {self._prefix}_replay_cb;',
+            '#endif',
+        ]
+        fn_init = Function(
+            'replay_init', FunctionType(
+                'replay_init', None,
+                [IndirectDeclarator('instance'), IndirectDeclarator('arg')],
+            ), 'static', [
+                f'{self._fn_init.identifier}(instance,'
+                f' &{self._prefix}_replay_cb, NULL, arg);',
+            ],
+        )
+        fn_state = Function(
+            'replay_state', FunctionType('replay_state', 'int', [
+                Declarator('instance', type_name='const void *'),
+            ]), 'static', [
+                f'const {type_fsm} * fsm = instance;',
+                'int state = fsm->state;',
+                'return ((0 <= state) && (state < NUM_STATE)) ? state : -1;',
+            ],
+        )
+        fn_dispatch = Function(
+            'replay_dispatch', FunctionType('replay_dispatch', None, [
+                IndirectDeclarator('instance'),
+                Declarator('event', type_name='int'),
+                Declarator('arg', type_name='const void *'),
+            ]), 'static', [
+                Comment('the callbacks must not write to the log'),
+                f'{self._fn_public_dispatch.identifier}'
+                '(instance, event, (void *) arg);',
+            ],
+        )
+        names = Array(
+            'replay_state_names', None, 'static', 'NUM_STATE',
+            [f'"{label}"' for label in self._state_parents],
+            'const char * const',
+        )
+        fn_main = Function(
+            'main', FunctionType('main', 'int', [
+                Declarator('argc', type_name='int'),
+                Declarator('argv', type_name='char **'),
+            ]), None,
+            ['return rsk_fsm_replay_main(argc, argv, &replay_fsm);'],
+        )
+        return [
+            '#ifndef REPLAY_EXTERN_CB',
+            fn_condition,
+            fn_action,
             '',
-        ] + [
-            fn.implementation for fn in self._fn_event_handlers
-        ] + [
+        ] + callbacks + [
             '',
-        ] + [
-            array.implementation for array in self._arrays_event_handlers
-        ] + [
+            fn_init,
+            fn_dispatch,
+            fn_state,
             '',
-            self._fn_init.implementation,
-        ] + [
-            fn.implementation for fn in self._fn_event_injectors
-        ] + [
+            names,
+            '',
+            'static const rsk_fsm_replay_fsm_t replay_fsm = {',
+            f'\t.size = sizeof({type_fsm}),',
+            '\t.init = replay_init,',
+            '\t.dispatch = replay_dispatch,',
+            '\t.state = replay_state,',
+            '\t.num_states = NUM_STATE,',
+            '\t.num_events = NUM_EVENT,',
+            '\t.state_names = replay_state_names,',
+            '};',
+            '',
+            fn_main,
             '',
             self.eof,
-        ])
+        ]
+    def write_files(self, directory):
+        """Write the C implementation to files in `directory`.
+
+        Write the C header to `<prefix>.h` and the C source to `<prefix>.c`,
+        where `<prefix>` is this implementation's prefix. If sharded, write the
+        private implementation header to `<prefix>_impl.h` and the handlers of
+        each shard to `<prefix>_<N>.c`, for N counting from 0, with no more
+        shards than handlers. If replayed, write the replay driver to
+        `<prefix>_replay.c`, to be linked with the C source and the replay
+        runtime `rsk_fsm_replay.c`.
+
+        Return a list of the names of the files written.
+        """
+        header = f'{self._prefix}.h'
+        includes = [f'#include "{header}"']
+        names = [header]
+        with open(
+                os.path.join(directory, header), 'w', encoding='utf-8',
+            ) as fid:
+            self.write_header(fid)
+            fid.write('\n')
+        if self._shards:
+            impl_header = f'{self._prefix}_impl.h'
+            includes.append(f'#include "{impl_header}"')
+            names.append(impl_header)
+            with open(
+                    os.path.join(directory, impl_header), 'w', encoding='utf-8',
+                ) as fid:
+                fid.write(self._impl_header + '\n')
+        source = f'{self._prefix}.c'
+        names.append(source)
+        with open(
+                os.path.join(directory, source), 'w', encoding='utf-8',
+            ) as fid:
+            fid.write('\n'.join(includes) + '\n\n')
+            self.write_source(fid)
+            fid.write('\n')
+        if self._shards:
+            for (index, handlers) in enumerate(self._shard_handlers()):
+                shard = f'{self._prefix}_{index}.c'
+                names.append(shard)
+                with open(
+                        os.path.join(directory, shard), 'w', encoding='utf-8',
+                    ) as fid:
+                    fid.write('\n'.join(includes) + '\n\n')
+                    for handler in handlers:
+                        handler.write(fid)
+                        fid.write('\n')
+                    fid.write('\n' + self.eof + '\n')
+        if self._replay:
+            driver = f'{self._prefix}_replay.c'
+            names.append(driver)
+            with open(
+                    os.path.join(directory, driver), 'w', encoding='utf-8',
+                ) as fid:
+                fid.write('\n'.join([
+                    '#include <stddef.h>',
+                    '',
+                    f'#include "{header}"',
+                    '#include "rsk_fsm_replay.h"',
+                ]) + '\n\n')
+                for (index, part) in enumerate(self._replay_parts):
+                    if index:
+                        fid.write('\n')
+                    if isinstance(part, str):
+                        fid.write(part)
+                    else:
+                        part.write(fid)
+                fid.write('\n')
+        return names
     def __str__(self):
         """Return the C header and C source implementations."""
-        return self.header + '\n' + self.source
+        fid = StringIO()
+        self.write(fid)
+        return fid.getvalue()
 
 class Builder(_Builder):
-    """A builder for target implementation of a FSM in C."""
+    """A builder for target implementation of a FSM in C.
+
+    If `broadcast` then build an implementation supporting broadcasting an event
+    to each FSM instance in a given state. If `queue` is non-zero then build an
+    implementation with a run-to-completion event queue of `queue` entries per
+    instance. If `mailbox` is non-zero then build an implementation with a
+    lock-free mailbox of `mailbox` entries per instance, for posting events from
+    any thread. If `dispatch` then build an implementation with a function for
+    injecting an event by number, and with `mailbox` for posting an event by
+    number and receiving a batch of posted events. If `atomic` then build an
+    implementation whose instances may be shared by several threads. If
+    `shards` is non-zero then build an implementation with handlers divided
+    between `shards` C source files. If `replay` then build an implementation
+    with a replay driver. See :class:`Implementation`.
+
+    If `jobs` is more than one then build and render the handlers for each
+    event in a pool of `jobs` worker processes.
+    """
+    def __init__(
+            self, prefix,
+            broadcast=False, queue=0, mailbox=0, dispatch=False, atomic=False,
+            shards=0, replay=False, jobs=1, report=None,
+        ): # pylint: disable=too-many-arguments
+        super().__init__(prefix, jobs, report)
+        self._options = {
+            'broadcast': broadcast,
+            'queue': queue,
+            'mailbox': mailbox,
+            'dispatch': dispatch,
+            'atomic': atomic,
+            'shards': shards,
+            'replay': replay,
+        }
+        ### a cache of state labels by absolute state pointer
+        self._state_labels = {}
     def pointer_to_state_label(self, pointer):
         """Return a label for a state from absolute state `pointer`."""
-        return '_'.join(self.pointer_to_path(pointer))
+        try:
+            return self._state_labels[pointer]
+        except KeyError:
+            pass
+        label = self._state_labels[pointer] = '_'.join(
+            self.pointer_to_path(pointer),
+        )
+        return label
     def fix_steps(self, transition):
         """Fix `transition` steps state pointers to state labels.
 
-        Replace each state pointer in `transition` steps with its state label.
+        Return a copy of `transition` with each state pointer in its steps
+        replaced with its state label. `transition` is not modified.
         """
+        steps = []
         for step in transition['steps']:
             try:
                 pointer = step['state']
             except KeyError:
+                steps.append(step)
                 continue
-            if pointer:
-                step['state'] = self.pointer_to_state_label(pointer)
-            else:
-                step['state'] = None
-        return transition
+            label = self.pointer_to_state_label(pointer) if pointer else None
+            steps.append({'state': label})
+        return dict(transition, steps=steps)
     def _get_initial_transition(self):
         """Return the initial transition for this FSM.
 
@@ -644,14 +1796,21 @@ class Builder(_Builder):
         transition steps replaced with its state label.
         """
         return [self.fix_steps(_) for _ in self.get_transitions(event, pointer)]
+    def new_implementation(self):
+        """Return a new, empty, :class:`Implementation` to build."""
+        return Implementation(f'{self._prefix}_fsm', **self._options)
     def build_implementation(self):
-        impl = Implementation(f'{self._prefix}_fsm')
+        impl = self.new_implementation()
         states = sorted(self.states)
         events = sorted(self.events)
         conditions = sorted(self.conditions)
         actions = sorted(self.actions)
+        labels = {_: self.pointer_to_state_label(_) for _ in states}
         for pointer in states:
-            impl.declare_state(self.pointer_to_state_label(pointer))
+            (_, *ancestors) = self.ancestors[pointer]
+            impl.declare_state(
+                labels[pointer], labels[ancestors[0]] if ancestors else None,
+            )
         for name in events:
             impl.declare_event(name)
         for name in conditions:
@@ -660,9 +1819,40 @@ class Builder(_Builder):
             impl.declare_action(name)
         transition = self._get_initial_transition()
         impl.define_init_handler(transition)
-        for event in events:
-            for pointer in states:
-                label = self.pointer_to_state_label(pointer)
-                transitions = self._get_transitions(event, pointer)
-                impl.define_handler(event, label, transitions)
+        # the handlers are generated as the implementation is written, after
+        # this builder is cleared for its next build: generate them from a
+        # shallow copy of this builder, keeping the state of this build
+        builder = copy(self)
+        # in a worker process, render each handler, so that its source rather
+        # than its statements is returned to this process, with its transitions
+        # only if needed for commits; return only the states handling the
+        # event, the others are unhandled
+        render = self._jobs > 1
+        commits = self._options['atomic'] or not render
+        # pylint: disable-next=protected-access
+        get_transitions = builder._get_transitions
+        def event_handlers(event):
+            handlers = {}
+            for (index, pointer) in enumerate(states):
+                transitions = get_transitions(event, pointer)
+                if transitions:
+                    handler = impl.new_handler(
+                        event, labels[pointer], transitions,
+                    )
+                    if render and handler is not None:
+                        handler = handler.render()
+                    handlers[index] = (
+                        transitions if commits else None, handler,
+                    )
+            return handlers
+        def define_handlers():
+            for (event, handlers) in zip(
+                    events, builder.map_events(event_handlers, events),
+                ):
+                for (index, pointer) in enumerate(states):
+                    (transitions, handler) = handlers.get(index, ([], None))
+                    yield (event, labels[pointer], transitions, handler)
+        # when reporting, generate the handlers in the emit phase rather than
+        # as they are written, so that each phase is timed separately
+        impl.define_handlers(define_handlers(), defer=self.report is None)
         return impl
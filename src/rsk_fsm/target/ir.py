@@ -0,0 +1,49 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Build an intermediate representation of a FSM.
+
+The intermediate representation is the result of analysing a FSM: its states,
+events, conditions, actions and the flattened steps of each transition. Any
+target implementation may be built from it, with :meth:`Builder.build_ir`,
+without repeating the analysis. See :meth:`rsk_fsm.build.Builder.get_ir`.
+"""
+
+import json
+import os
+
+from ..build import Builder as _Builder
+
+class Implementation():
+    """An instance of this class is an intermediate representation of a FSM.
+
+    The string representation is compact JSON.
+    """
+    def __init__(self, prefix, ir):
+        self._prefix = prefix
+        self.ir = ir
+    def write(self, fp):
+        """Write the intermediate representation to file object `fp`."""
+        json.dump(self.ir, fp, separators=(',', ':'))
+    def write_files(self, directory):
+        """Write the intermediate representation to a file in `directory`.
+
+        Write the intermediate representation to `<prefix>_fsm.ir`, where
+        `<prefix>` is this implementation's prefix. Return a list of the names
+        of the files written.
+        """
+        name = f'{self._prefix}_fsm.ir'
+        with open(os.path.join(directory, name), 'w', encoding='utf-8') as fid:
+            self.write(fid)
+            fid.write('\n')
+        return [name]
+    def __str__(self):
+        return json.dumps(self.ir, separators=(',', ':'))
+
+class Builder(_Builder):
+    """A builder for the intermediate representation of a FSM.
+
+    If `jobs` is more than one then build the transitions for each event in a
+    pool of `jobs` worker processes.
+    """
+    def build_implementation(self):
+        return Implementation(self._prefix, self.get_ir())
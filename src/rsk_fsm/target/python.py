@@ -2,6 +2,8 @@
 
 """Build a Python implementation of a FSM."""
 
+import os
+
 from ..build import Builder as _Builder
 
 INDENT = ' ' * 4
@@ -26,15 +28,6 @@ def call(expr, args):
     """Return Python source for calling function `expr` with `args`."""
     return f'{expr}({", ".join(args)})'
 
-def try_block(stmt, exception):
-    """Return Python source for try `stmt`, ignoring `exception`."""
-    return '\n'.join([
-        'try:',
-        indent(stmt),
-        f'except {exception}:',
-        indent('pass'),
-    ])
-
 def if_then(expr, taken, block):
     """Return Python source for conditionally executing `block` statements.
 
@@ -59,9 +52,12 @@ class Block():
         return '\n'.join([str(_) for _ in self._stmts])
 
 class Function():
-    """Python function."""
-    def __init__(self, name, decorator=None, args=(), doc=None):
+    """Python function, a coroutine function if `asynchronous`."""
+    def __init__( # pylint: disable=too-many-arguments
+            self, name, decorator=None, args=(), doc=None, asynchronous=False,
+        ):
         self._name = name
+        self._asynchronous = asynchronous
         self._decorator = decorator
         self._args = args
         self._doc = docstring(doc) if doc else None
@@ -76,7 +72,10 @@ class Function():
         stmts = []
         if self._decorator:
             stmts.append(self._decorator)
-        stmts.append(f'def {self._name}({", ".join(self._args)}):')
+        stmts.append(
+            ('async ' if self._asynchronous else '')
+            + f'def {self._name}({", ".join(self._args)}):'
+        )
         subs = [self._doc] if self._doc else []
         subs += self._stmts if self._stmts else ['pass']
         return '\n'.join(stmts) + '\n' + '\n'.join([indent(_) for _ in subs])
@@ -85,9 +84,12 @@ class Function():
         """Return Python source for a staticmethod."""
         return cls(name, '@staticmethod', args, doc)
     @classmethod
-    def method(cls, name, args=(), doc=None):
+    def method(cls, name, args=(), doc=None, asynchronous=False):
         """Return a new object for a Python method."""
-        return cls(name, args=('self',) + tuple(args), doc=doc)
+        return cls(
+            name, args=('self',) + tuple(args), doc=doc,
+            asynchronous=asynchronous,
+        )
 
 class Class(): # pylint: disable=too-few-public-methods
     """Python class."""
@@ -109,10 +111,43 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
     """An instance of this class is a FSM implemented in Python.
 
     The string representation is the Python source code implementation.
+
+    The `Fsm` class declares `__slots__`, for smaller and faster instances: an
+    instance may be weakly referenced, but has no attributes other than those
+    of the implementation. Keep any other per-instance data in its `data`.
+
+    If `vectorise` then the implementation also has a NumPy table of the next
+    state on each event in each state, and a function `step(states, events)`
+    returning the next states of any number of FSM instances at once. Such an
+    instance is just its state number, or `FINAL_STATE`. The FSM must have no
+    actions or conditions.
+
+    If `asyncio` then the implementation is for use with :mod:`asyncio`. Any
+    condition or action callback may return an awaitable, which is awaited
+    before the transition continues. Injecting an event posts it to the FSM
+    instance's queue, processed run-to-completion by coroutine method
+    `process()` or `run()`.
+
+    If `match` then, instead of a handler function for each event in each
+    state, the implementation has one method `inject(event, arg)` with a
+    `match` statement on the state and event name, and each transition
+    inline. This cannot be combined with `asyncio`.
     """
     callback_args = ('fsm', 'arg')
-    def __init__(self, prefix, label, states, events, conditions, actions): # pylint: disable=too-many-arguments
+    def __init__(
+            self, prefix, label, states, events, conditions, actions,
+            vectorise=False, asyncio=False, match=False,
+        ): # pylint: disable=too-many-arguments
+        if vectorise and (conditions or actions):
+            raise ValueError(
+                'a vectorised FSM cannot have conditions or actions'
+            )
+        if match and asyncio:
+            raise ValueError('match cannot be combined with asyncio')
         self._prefix = prefix
+        self._vectorise = vectorise
+        self._asyncio = asyncio
+        self._match = match
         ### the function for generating a state label from a state pointer
         self._label = label
         self._states = states
@@ -121,6 +156,8 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
         self._actions = actions
         self._initial_transition = None
         self._event_transitions = {}
+        ### source strings handling each event, rendered in worker processes
+        self._rendered = {}
     def initial_transition(self, transition):
         """Record `transition` as the initial transition."""
         self._initial_transition = transition
@@ -130,11 +167,69 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
             self._event_transitions[event][state] = transitions
         except KeyError:
             self._event_transitions[event] = {state: transitions}
+    def render_handlers(self, event):
+        """Return a list of source strings handling `event`.
+
+        Return the handler functions and handler table for `event` or, if this
+        implementation has a `match` dispatcher, its cases for `event`. This
+        does not change this implementation, so may be called in a worker
+        process: see :meth:`rendered_handlers`.
+        """
+        if self._match:
+            return self._event_cases(event)
+        stmts = []
+        handlers = []
+        for state in self._states:
+            try:
+                transitions = self._event_transitions[event][state]
+            except KeyError:
+                handlers.append(f'None, {comment(self._state_label(state))}')
+                continue
+            name = f'handle_{event}_in_{self._label(state)}'
+            stmts += [
+                str(self._transition_function(
+                    name,
+                    f'Handle event {event} in state {state}',
+                    transitions,
+                )),
+                '',
+            ]
+            handlers.append(f'{name}, {comment(self._state_label(state))}')
+        if event in self._event_transitions:
+            stmts += [
+                assignment(
+                    f'TRANSITION_ON_EVENT_{event}',
+                    '\n'.join([
+                        '('
+                    ] + [
+                        indent(h) for h in handlers
+                    ] + [
+                        ')',
+                    ]),
+                ),
+                '',
+            ]
+        return stmts
+    def rendered_handlers(self, event, stmts):
+        """Record `stmts`, from :meth:`render_handlers`, as handling `event`."""
+        self._rendered[event] = stmts
+    def _handlers(self, event):
+        """Return a list of source strings handling `event`.
+
+        See :meth:`render_handlers`.
+        """
+        try:
+            return self._rendered[event]
+        except KeyError:
+            return self.render_handlers(event)
     def _state_label(self, state):
         """Return a Python variable name for use as a state label."""
         return 'STATE_' + self._label(state)
-    def _steps_to_statements(self, steps):
-        """A generator yielding statements implementing transition `steps`."""
+    def _steps_to_statements(self, steps, fsm='fsm'):
+        """A generator yielding statements implementing transition `steps`.
+
+        `fsm` is the name of the variable for the FSM instance.
+        """
         for step in steps:
             try:
                 actions = step['actions']
@@ -142,36 +237,75 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
                 pass
             else:
                 for action in actions:
-                    yield call(
-                        f'fsm.callbacks.action_{action}',
-                        self.callback_args,
-                    )
+                    yield self._callback(f'callbacks.action_{action}', fsm=fsm)
             try:
                 next_ = step['state']
             except KeyError:
                 pass
             else:
                 yield assignment(
-                    'fsm.state',
+                    f'{fsm}.state',
                     self._state_label(next_) if next_ else None,
                 )
+    def _callback(self, expr, result=None, fsm='fsm'):
+        """Return Python source for calling callback function `expr`.
+
+        `fsm` is the name of the variable for the FSM instance. If this
+        implementation is for :mod:`asyncio` then await the callback's result
+        if it is awaitable and, if `result`, assign the awaited result to
+        variable `result`.
+        """
+        stmt = call(expr, (fsm, 'arg'))
+        if not self._asyncio:
+            return stmt
+        var = result or 'result'
+        await_ = (
+            assignment(result, f'await {var}') if result else f'await {var}'
+        )
+        return if_then(f'isawaitable({var} := {stmt})', True, [await_])
     def _transition_function(self, name, doc, transitions):
         """Return a :class:`Function` implementing steps for `transitions`."""
-        func = Function(name, args=self.callback_args, doc=doc)
+        func = Function(
+            name, args=self.callback_args, doc=doc,
+            asynchronous=self._asyncio,
+        )
+        func.statements(*self._transition_statements(transitions))
+        return func
+    def _transition_statements(self, transitions, fsm='fsm'):
+        """Return a list of statements implementing steps for `transitions`.
+
+        `fsm` is the name of the variable for the FSM instance. The statements
+        return after taking a conditional transition.
+        """
+        stmts = []
+        if any(
+                transition.get('condition') or any(
+                    step.get('actions') for step in transition['steps']
+                ) for transition in transitions
+            ):
+            # look up callbacks once, not for each condition and action
+            stmts.append(assignment('callbacks', f'{fsm}.callbacks'))
         for transition in transitions:
-            block = Block(list(self._steps_to_statements(transition['steps'])))
+            block = Block(list(
+                self._steps_to_statements(transition['steps'], fsm)
+            ))
             try:
                 condition = transition['condition']
             except KeyError:
                 condition = None
             if condition:
                 block.statement('return')
-                expr = f'fsm.callbacks.condition_{condition}(fsm, arg)'
+                expr = call(f'callbacks.condition_{condition}', (fsm, 'arg'))
+                if self._asyncio:
+                    stmts.append(self._callback(
+                        f'callbacks.condition_{condition}', 'result', fsm,
+                    ))
+                    expr = 'result'
                 taken = transition['taken']
-                func.statement(if_then(expr, taken, block))
+                stmts.append(if_then(expr, taken, block))
             else:
-                func.statement(block)
-        return func
+                stmts.extend(block)
+        return stmts
     @property
     def _globals_block(self):
         """Return a :class:`Block` of global source code statements."""
@@ -181,6 +315,14 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
             comment('pylint: disable=invalid-name'),
             '',
         ])
+        if self._vectorise:
+            block.statements('import numpy', '')
+        if self._asyncio:
+            block.statements(
+                'from asyncio import Queue',
+                'from inspect import isawaitable',
+                '',
+            )
         ### enum of state constants
         for (idx, state) in enumerate(self._states):
             block.statement(
@@ -196,38 +338,73 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
             ),
             '',
         )
-        ### functions and handler mappings for event transitions
-        for event in self._events:
-            handlers = []
-            for state in self._states:
-                try:
-                    transitions = self._event_transitions[event][state]
-                except KeyError:
-                    continue
-                name = f'handle_{event}_in_{self._label(state)}'
-                block.statement(
-                    self._transition_function(
-                        name,
-                        f'Handle event {event} in state {state}',
-                        transitions,
-                    ),
-                )
-                block.statement('')
-                handlers.append(f'{self._state_label(state)}: {name},')
-            if handlers:
-                block.statement(
-                    assignment(
-                        f'TRANSITION_ON_EVENT_{event}',
-                        '\n'.join([
-                            '{'
-                        ] + [
-                            indent(h) for h in handlers
-                        ] + [
-                            '}',
-                        ]),
-                    ),
-                )
-                block.statement('')
+        ### functions and handler tables for event transitions, indexed by
+        ### state, with None for a state not handling the event
+        for event in self._events if not self._match else ():
+            block.statements(*self._handlers(event))
+        if self._vectorise:
+            block.statements(*self._vectorised_block)
+        return block
+    def _next_state(self, event, state):
+        """Return the index of the state after `event` in `state`.
+
+        Return -1 if the state after `event` is the final state.
+        """
+        try:
+            transitions = self._event_transitions[event][state]
+        except KeyError:
+            return self._states.index(state)
+        # without conditions, the only transition is unconditional
+        next_ = state
+        for step in transitions[0]['steps']:
+            if 'state' in step:
+                next_ = step['state']
+        return self._states.index(next_) if next_ else -1
+    @property
+    def _vectorised_block(self):
+        """Return a :class:`Block` of source code for vectorised stepping."""
+        block = Block()
+        for (idx, event) in enumerate(self._events):
+            block.statement(assignment(f'EVENT_{event}', idx))
+        initial = [
+            step['state'] for step in self._initial_transition['steps']
+            if 'state' in step
+        ][-1]
+        block.statements(
+            '',
+            assignment('INITIAL_STATE', self._state_label(initial)),
+            assignment('FINAL_STATE', -1),
+            '',
+            comment(
+                'the next state on each event (row) in each state (column),'
+            ),
+            comment('with the final state in the last column'),
+        )
+        rows = [
+            '[' + ', '.join(
+                [str(self._next_state(event, state)) for state in self._states]
+                + ['-1']
+            ) + f'], {comment(f"EVENT_{event}")}'
+            for event in self._events
+        ]
+        num_states = len(self._states)
+        dtype = (
+            'int8' if num_states < 2 ** 7 else
+            'int16' if num_states < 2 ** 15 else
+            'int32'
+        )
+        block.statement(assignment('NEXT_STATE', '\n'.join(
+            ['numpy.array(['] + [indent(_) for _ in rows] + [
+                f'], dtype=numpy.{dtype})',
+            ]
+        )))
+        block.statement('')
+        func = Function(
+            'step', args=('states', 'events'),
+            doc='Return the next states of instances in `states` on `events`',
+        )
+        func.statement('return NEXT_STATE[events, states]')
+        block.statements(func, '')
         return block
     @property
     def _callbacks_class(self):
@@ -252,6 +429,13 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
     def _fsm_class(self):
         """Return a :class:`Class` for FSM."""
         cls = Class('Fsm', doc=f'A class for {self._prefix} FSM instances')
+        if self._asyncio:
+            return self._fsm_class_asyncio(cls)
+        if self._match:
+            return self._fsm_class_match(cls)
+        cls.statement(assignment(
+            '__slots__', "('state', 'callbacks', 'data', '__weakref__')",
+        ))
         method = Function.method(
             '__init__',
             args=('callbacks=None', 'data=None', 'arg=None'),
@@ -283,17 +467,173 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
                 doc=f'Inject event {event} with event `arg`',
             )
             args[0] = 'self' # provide FSM instance as `fsm`
-            method.statement(
-                try_block(
-                    call(
-                        f'TRANSITION_ON_EVENT_{event}[self.state]',
-                        args,
-                    ),
-                    'KeyError',
-                ),
+            method.statements(
+                assignment('state', 'self.state'),
+                # the final state is None
+                'if state is not None:',
+                indent(assignment(
+                    'handler',
+                    f'TRANSITION_ON_EVENT_{event}[state]',
+                )),
+                indent(if_then('handler is not None', True, [
+                    call('handler', args),
+                ])),
+            )
+            cls.statement(method)
+        return cls
+    def _fsm_class_match(self, cls):
+        """Return :class:`Class` `cls` for FSM, with a match dispatcher."""
+        cls.statement(assignment(
+            '__slots__', "('state', 'callbacks', 'data', '__weakref__')",
+        ))
+        method = Function.method(
+            '__init__',
+            args=('callbacks=None', 'data=None', 'arg=None'),
+        )
+        method.statements(
+            assignment('self.state', 'None'),
+            assignment(
+                'self.callbacks', 'self if callbacks is None else callbacks',
+            ),
+            assignment('self.data', 'self if data is None else data'),
+            call('initial_transition', ('self', 'arg')),
+        )
+        cls.statement(method)
+        method = Function.method(
+            'inject',
+            args=('event', 'arg=None'),
+            doc='Inject event named `event` with event `arg`',
+        )
+        cases = []
+        for event in self._events:
+            cases += self._handlers(event)
+        # the final state is None and matches no case
+        cases.append('case _:\n' + indent('pass'))
+        method.statement(
+            'match (self.state, event):\n'
+            + '\n'.join(indent(_) for _ in cases)
+        )
+        cls.statement(method)
+        for event in self._events:
+            method = Function.method(
+                f'inject_{event}',
+                args=('arg=None',),
+                doc=f'Inject event {event} with event `arg`',
             )
+            method.statement(call('self.inject', (repr(event), 'arg')))
             cls.statement(method)
         return cls
+    def _event_cases(self, event):
+        """Return a list of the `match` dispatcher cases handling `event`."""
+        # case patterns are literals: a bare name would capture, not match
+        cases = []
+        for state in self._states:
+            try:
+                transitions = self._event_transitions[event][state]
+            except KeyError:
+                continue
+            idx = self._states.index(state)
+            cases.append(
+                f'case ({idx}, {event!r}): '
+                + comment(self._state_label(state)) + '\n'
+                + '\n'.join(indent(_) for _ in (
+                    self._transition_statements(transitions, 'self')
+                    or ['pass']
+                ))
+            )
+        return cases
+    def _fsm_class_asyncio(self, cls):
+        """Return :class:`Class` `cls` for FSM, completed for asyncio."""
+        cls.statement(assignment(
+            '__slots__',
+            "('state', 'callbacks', 'data', 'queue', '__weakref__')",
+        ))
+        method = Function.method(
+            '__init__',
+            args=('callbacks=None', 'data=None', 'arg=None'),
+        )
+        method.statements(
+            assignment('self.state', 'None'),
+            assignment(
+                'self.callbacks', 'self if callbacks is None else callbacks',
+            ),
+            assignment('self.data', 'self if data is None else data'),
+            assignment('self.queue', 'Queue()'),
+            # no handlers for the initial transition, see _dispatch()
+            call('self.queue.put_nowait', ('(None, arg)',)),
+        )
+        cls.statement(method)
+        for event in self._events:
+            method = Function.method(
+                f'inject_{event}',
+                args=('arg=None',),
+                doc=f'Inject event {event} with event `arg`',
+            )
+            method.statement(call(
+                'self.queue.put_nowait',
+                (f'(TRANSITION_ON_EVENT_{event}, arg)',),
+            ))
+            cls.statement(method)
+        method = Function.method(
+            'process',
+            doc='Process injected events until there are none',
+            asynchronous=True,
+        )
+        method.statements(
+            assignment('queue', 'self.queue'),
+            'while not queue.empty():',
+            indent('await self._dispatch(*queue.get_nowait())'),
+            indent('queue.task_done()'),
+        )
+        cls.statement(method)
+        method = Function.method(
+            'run',
+            doc='Process injected events, waiting for events, until cancelled',
+            asynchronous=True,
+        )
+        method.statements(
+            assignment('queue', 'self.queue'),
+            'while True:',
+            indent('await self._dispatch(*await queue.get())'),
+            indent('queue.task_done()'),
+        )
+        cls.statement(method)
+        method = Function.method(
+            '_dispatch',
+            args=('handlers', 'arg'),
+            doc='Process an event with `handlers` indexed by state',
+            asynchronous=True,
+        )
+        method.statements(
+            if_then('handlers is None', True, [
+                'await initial_transition(self, arg)',
+                'return',
+            ]),
+            assignment('state', 'self.state'),
+            # the final state is None
+            'if state is not None:',
+            indent(assignment('handler', 'handlers[state]')),
+            indent(if_then('handler is not None', True, [
+                'await handler(self, arg)',
+            ])),
+        )
+        cls.statement(method)
+        return cls
+    def write(self, fp):
+        """Write the Python source implementation to file object `fp`."""
+        fp.write(str(self))
+    def write_files(self, directory):
+        """Write the Python source implementation to a file in `directory`.
+
+        Write the Python source to `<prefix>_fsm.py`, where `<prefix>` is this
+        implementation's prefix. Return a list of the names of the files
+        written.
+        """
+        name = f'{self._prefix}_fsm.py'
+        with open(os.path.join(directory, name), 'w', encoding='utf-8') as fid:
+            self.write(fid)
+            fid.write('\n')
+        return [name]
     def __str__(self):
         return '\n'.join((
             str(b) for b in (
@@ -305,7 +645,25 @@ class Implementation(): # pylint: disable=too-many-instance-attributes
         ))
 
 class Builder(_Builder):
-    """A builder for target implementation of a FSM in Python."""
+    """A builder for target implementation of a FSM in Python.
+
+    If `vectorise` then build an implementation with a NumPy engine for
+    stepping many FSM instances at once. If `asyncio` then build an
+    implementation for use with :mod:`asyncio`. If `match` then build an
+    implementation dispatching events with a `match` statement. See
+    :class:`Implementation`.
+
+    If `jobs` is more than one then build and render the handlers for each
+    event in a pool of `jobs` worker processes.
+    """
+    def __init__( # pylint: disable=too-many-arguments
+            self, prefix, vectorise=False, asyncio=False, match=False,
+            jobs=1, report=None,
+        ):
+        super().__init__(prefix, jobs, report)
+        self._vectorise = vectorise
+        self._asyncio = asyncio
+        self._match = match
     def pointer_to_state_label(self, pointer):
         """Return a label for a state from absolute state `pointer`."""
         return '_'.join(self.pointer_to_path(pointer))
@@ -321,13 +679,33 @@ class Builder(_Builder):
             events,
             conditions,
             actions,
+            self._vectorise,
+            self._asyncio,
+            self._match,
         )
         transition = self.get_initial_transition()
         impl.initial_transition(transition)
-        for event in events:
-            for state in self.states:
-                transitions = self.get_transitions(event, state)
-                if not transitions:
-                    continue
+        # in a worker process, also render the event's handlers, so that their
+        # source is returned to this process, with its transitions only if
+        # needed for the vectorised table
+        render = self._jobs > 1
+        def event_transitions(event):
+            handlers = [
+                (state, transitions) for (state, transitions) in (
+                    (_, self.get_transitions(event, _)) for _ in self.states
+                ) if transitions
+            ]
+            if not render:
+                return (handlers, None)
+            for (state, transitions) in handlers:
+                impl.event_transitions(event, state, transitions)
+            stmts = impl.render_handlers(event)
+            return (handlers if self._vectorise else [], stmts)
+        for (event, (handlers, stmts)) in zip(
+                events, self.map_events(event_transitions, events),
+            ):
+            for (state, transitions) in handlers:
                 impl.event_transitions(event, state, transitions)
+            if stmts is not None:
+                impl.rendered_handlers(event, stmts)
         return impl
@@ -0,0 +1,680 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Build a CPython extension module implementation of a FSM.
+
+The extension module wraps the C implementation of the FSM (see
+:mod:`rsk_fsm.target.c`) with the same `Fsm` and `Callbacks` interface as the
+Python implementation (see :mod:`rsk_fsm.target.python`).
+"""
+
+import os
+
+from .c import (
+    Array, Comment, Declarator, Enum, Function, FunctionType, IfCondition,
+    IndirectDeclarator, Struct,
+)
+from .c import Builder as _Builder
+from .c import Implementation as _Implementation
+
+### the C preprocessor lines preceding all others in the extension module
+INCLUDES = (
+    '#define PY_SSIZE_T_CLEAN',
+    '#include <Python.h>',
+    '#include <structmember.h>',
+)
+
+def _string(string):
+    """Return a C string literal for `string`."""
+    return '"' + string.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+# pylint: disable-next=too-many-instance-attributes
+class Implementation(_Implementation):
+    """An instance of this class is a FSM implemented as a CPython extension.
+
+    The string representation is the C implementation of the FSM followed by
+    the extension module source: one C translation unit.
+
+    The extension module `<prefix>_fsm` has the constants, and the `Fsm` and
+    `Callbacks` classes, of the Python implementation. Its constants also
+    include `EVENT_<E>`, the number of each event, for the `Fsm` method
+    `inject_events(events, arg=None)`, which injects each event in sequence
+    `events` with `arg` in one call. `events` may be a bytes-like object, with
+    one event number per byte.
+
+    An `Fsm` instance looks up each callback once, when it is initialised. A
+    callback which is absent, or None, is not called: an action does nothing,
+    a condition is false. Only the other callbacks are called in Python. If a
+    callback raises an exception then the remaining callbacks of the
+    transition are skipped, and the exception is raised by the injector; the
+    FSM state is then the state the transition would have ended in.
+    """
+    def __init__(self, prefix):
+        super().__init__(f'{prefix}_fsm', dispatch=True)
+        self._name = prefix
+        self._states = []
+        self._events = []
+        ### C types
+        type_callback = Enum('callback')
+        type_object = Struct('fsm_object')
+        type_call_condition = FunctionType('call_condition', 'int')
+        type_call_action = FunctionType('call_action')
+        type_traverse = FunctionType('traverse', 'int')
+        type_clear = FunctionType('clear', 'int')
+        type_dealloc = FunctionType('dealloc')
+        type_new = FunctionType('new', 'PyObject *')
+        type_init = FunctionType('init', 'int')
+        type_dispatch = FunctionType('dispatch', 'int')
+        type_inject = FunctionType('inject', 'PyObject *')
+        type_fastcall = FunctionType('fastcall', 'PyObject *')
+        type_inject_events = FunctionType('inject_events', 'PyObject *')
+        type_get_state = FunctionType('get_state', 'PyObject *')
+        type_set_state = FunctionType('set_state', 'int')
+        type_not_implemented = FunctionType('not_implemented', 'PyObject *')
+        type_module_init = FunctionType('module_init', 'PyMODINIT_FUNC')
+        ### C functions
+        fn_call_condition = Function(
+            'call_condition', type_call_condition, 'static',
+        )
+        fn_call_action = Function('call_action', type_call_action, 'static')
+        fn_ignore_condition = Function(
+            'ignore_condition', self._type_condition, 'static',
+        )
+        fn_ignore_action = Function(
+            'ignore_action', self._type_action, 'static',
+        )
+        fn_traverse = Function('fsm_traverse', type_traverse, 'static')
+        fn_clear = Function('fsm_clear', type_clear, 'static')
+        fn_dealloc = Function('fsm_dealloc', type_dealloc, 'static')
+        fn_dispatch = Function('dispatch', type_dispatch, 'static')
+        fn_inject = Function('inject', type_inject, 'static')
+        fn_inject_events = Function(
+            'fsm_inject_events', type_inject_events, 'static',
+        )
+        fn_get_state = Function('fsm_get_state', type_get_state, 'static')
+        fn_set_state = Function('fsm_set_state', type_set_state, 'static')
+        fn_not_implemented = Function(
+            'not_implemented', type_not_implemented, 'static',
+        )
+        fn_module_init = Function(f'PyInit_{prefix}_fsm', type_module_init)
+        ### complete all parts which do not depend upon FSM details
+        ptr_self = type_object.pointer('self')
+        ptr_fsm = self._type_fsm.pointer('fsm')
+        decl_arg = IndirectDeclarator('arg')
+        decl_object_arg = IndirectDeclarator('arg', type_name='PyObject')
+        var_callback = Declarator('callback', type_name='int')
+        var_event = Declarator('event', type_name='long')
+        decl_fastcall = [
+            IndirectDeclarator('args', type_name='PyObject * const'),
+            Declarator('nargs', type_name='Py_ssize_t'),
+            IndirectDeclarator('kwnames', type_name='PyObject'),
+        ]
+        decl_keywords = [
+            IndirectDeclarator('args', type_name='PyObject'),
+            IndirectDeclarator('kwds', type_name='PyObject'),
+        ]
+        decl_closure = IndirectDeclarator('closure')
+        type_object.extend([
+            Declarator('ob_base', type_name='PyObject'),
+            self._type_fsm.variable('fsm'),
+            self._type_fsm_cb.variable('cb'),
+            IndirectDeclarator('callbacks', type_name='PyObject'),
+            IndirectDeclarator('data', type_name='PyObject'),
+            IndirectDeclarator(
+                f'callables[{type_callback.num_values}]', type_name='PyObject',
+            ),
+            Declarator('failed', type_name='int'),
+            IndirectDeclarator('weakreflist', type_name='PyObject'),
+        ])
+        type_call_condition.extend([ptr_fsm, var_callback, decl_arg])
+        type_call_action.extend([ptr_fsm, var_callback, decl_arg])
+        type_traverse.extend([
+            ptr_self,
+            Declarator('visit', type_name='visitproc'),
+            decl_arg,
+        ])
+        type_clear.append(ptr_self)
+        type_dealloc.append(ptr_self)
+        type_new.extend([
+            IndirectDeclarator('type', type_name='PyTypeObject'),
+        ] + decl_keywords)
+        type_init.extend([ptr_self] + decl_keywords)
+        type_dispatch.extend([ptr_self, var_event, decl_object_arg])
+        type_inject.extend([ptr_self, var_event] + decl_fastcall)
+        type_fastcall.extend([ptr_self] + decl_fastcall)
+        type_inject_events.extend([ptr_self] + decl_keywords)
+        type_get_state.extend([ptr_self, decl_closure])
+        type_set_state.extend([
+            ptr_self,
+            IndirectDeclarator('value', type_name='PyObject'),
+            decl_closure,
+        ])
+        type_not_implemented.extend([
+            IndirectDeclarator('unused', type_name='PyObject'),
+            IndirectDeclarator('args', type_name='PyObject'),
+        ])
+        ### add statements which do not depend upon FSM details
+        num_callback = type_callback.num_values
+        fn_call_condition.extend([
+            f'{ptr_self} = fsm->data;',
+            'PyObject * args[2] = {(PyObject *) self, arg};',
+            'PyObject * result;',
+            'int taken;',
+            IfCondition('self->failed || !self->callables[callback]', [
+                'return 0;',
+            ]),
+            'result = PyObject_Vectorcall('
+            'self->callables[callback], args, 2, NULL);',
+            IfCondition('!result', ['self->failed = 1;', 'return 0;']),
+            'taken = PyObject_IsTrue(result);',
+            'Py_DECREF(result);',
+            IfCondition('taken < 0', ['self->failed = 1;', 'return 0;']),
+            'return taken;',
+        ])
+        fn_call_action.extend([
+            f'{ptr_self} = fsm->data;',
+            'PyObject * args[2] = {(PyObject *) self, arg};',
+            'PyObject * result;',
+            IfCondition('self->failed || !self->callables[callback]', [
+                'return;',
+            ]),
+            'result = PyObject_Vectorcall('
+            'self->callables[callback], args, 2, NULL);',
+            IfCondition('!result', ['self->failed = 1;', 'return;']),
+            'Py_DECREF(result);',
+        ])
+        fn_ignore_condition.append('return 0;')
+        fn_ignore_action.append(Comment('empty'))
+        fn_traverse.extend([
+            'int callback;',
+            'Py_VISIT(self->callbacks);',
+            'Py_VISIT(self->data);',
+            f'for (callback = 0; callback < {num_callback}; callback++) {{',
+            '\tPy_VISIT(self->callables[callback]);',
+            '}',
+            'return 0;',
+        ])
+        fn_clear.extend([
+            'int callback;',
+            'Py_CLEAR(self->callbacks);',
+            'Py_CLEAR(self->data);',
+            f'for (callback = 0; callback < {num_callback}; callback++) {{',
+            '\tPy_CLEAR(self->callables[callback]);',
+            '}',
+            'return 0;',
+        ])
+        fn_dealloc.extend([
+            'PyObject_GC_UnTrack(self);',
+            IfCondition('self->weakreflist', [
+                'PyObject_ClearWeakRefs((PyObject *) self);',
+            ]),
+            'fsm_clear(self);',
+            'Py_TYPE(self)->tp_free((PyObject *) self);',
+        ])
+        init_statements = [
+            'static char * keywords[] = {"callbacks", "data", "arg", NULL};',
+            'PyObject * callbacks = Py_None;',
+            'PyObject * data = Py_None;',
+            'PyObject * arg = Py_None;',
+            'PyObject * callable;',
+            'int callback;',
+            IfCondition(
+                '!PyArg_ParseTupleAndKeywords(args, kwds, "|OOO:Fsm", keywords,'
+                ' &callbacks, &data, &arg)',
+                ['return -1;'],
+            ),
+            'fsm_clear(self);',
+            'self->callbacks = Py_NewRef('
+            'callbacks == Py_None ? (PyObject *) self : callbacks);',
+            'self->data = Py_NewRef('
+            'data == Py_None ? (PyObject *) self : data);',
+            Comment('look up each callback once, ignoring absent callbacks'),
+            f'for (callback = 0; callback < {num_callback}; callback++) {{',
+            '\tcallable = PyObject_GetAttrString('
+            'self->callbacks, callback_names[callback]);',
+            '\tif (!callable) {',
+            '\t\tif (!PyErr_ExceptionMatches(PyExc_AttributeError)) {',
+            '\t\t\treturn -1;',
+            '\t\t}',
+            '\t\tPyErr_Clear();',
+            '\t} else if (callable == Py_None) {',
+            '\t\tPy_DECREF(callable);',
+            '\t} else {',
+            '\t\tself->callables[callback] = callable;',
+            '\t}',
+            '}',
+        ]
+        fn_dispatch.extend([
+            IfCondition('(event < 0) || (NUM_EVENT <= event)', [
+                'PyErr_Format(PyExc_ValueError, "%ld is not an event", event);',
+                'return -1;',
+            ]),
+            f'{prefix}_fsm_dispatch(&self->fsm, (int) event, arg);',
+            IfCondition('self->failed', ['self->failed = 0;', 'return -1;']),
+            'return 0;',
+        ])
+        fn_inject.extend([
+            'Py_ssize_t nkwargs = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;',
+            IfCondition('nargs + nkwargs > 1', [
+                'PyErr_SetString(PyExc_TypeError,'
+                ' "expected at most one argument, arg");',
+                'return NULL;',
+            ]),
+            IfCondition(
+                'nkwargs && PyUnicode_CompareWithASCIIString('
+                'PyTuple_GET_ITEM(kwnames, 0), "arg")',
+                [
+                    'PyErr_SetString(PyExc_TypeError,'
+                    ' "unexpected keyword argument");',
+                    'return NULL;',
+                ],
+            ),
+            IfCondition(
+                'dispatch(self, event, nargs + nkwargs ? args[0] : Py_None)',
+                ['return NULL;'],
+            ),
+            'Py_RETURN_NONE;',
+        ])
+        fn_inject_events.extend([
+            'static char * keywords[] = {"events", "arg", NULL};',
+            'PyObject * events;',
+            'PyObject * arg = Py_None;',
+            'PyObject * sequence;',
+            'Py_buffer view;',
+            'Py_ssize_t index;',
+            'long event;',
+            IfCondition(
+                '!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:inject_events",'
+                ' keywords, &events, &arg)',
+                ['return NULL;'],
+            ),
+            Comment('inject events from bytes without creating int objects'),
+            IfCondition(
+                'PyObject_CheckBuffer(events)'
+                ' && !PyObject_GetBuffer('
+                'events, &view, PyBUF_FORMAT | PyBUF_ND)',
+                [
+                    IfCondition(
+                        '(view.itemsize == 1)'
+                        ' && !strcmp(view.format ? view.format : "B", "B")',
+                        [
+                            'for (index = 0; index < view.len; index++) {',
+                            '\tevent ='
+                            ' ((const unsigned char *) view.buf)[index];',
+                            '\tif (dispatch(self, event, arg)) {',
+                            '\t\tPyBuffer_Release(&view);',
+                            '\t\treturn NULL;',
+                            '\t}',
+                            '}',
+                            'PyBuffer_Release(&view);',
+                            'Py_RETURN_NONE;',
+                        ],
+                    ),
+                    'PyBuffer_Release(&view);',
+                ],
+            ),
+            'PyErr_Clear();',
+            'sequence = PySequence_Fast(events,'
+            ' "events must be a sequence of event numbers");',
+            IfCondition('!sequence', ['return NULL;']),
+            'for (index = 0;'
+            ' index < PySequence_Fast_GET_SIZE(sequence); index++) {',
+            '\tevent = PyLong_AsLong('
+            'PySequence_Fast_GET_ITEM(sequence, index));',
+            '\tif (((event == -1) && PyErr_Occurred())'
+            ' || dispatch(self, event, arg)) {',
+            '\t\tPy_DECREF(sequence);',
+            '\t\treturn NULL;',
+            '\t}',
+            '}',
+            'Py_DECREF(sequence);',
+            'Py_RETURN_NONE;',
+        ])
+        fn_get_state.extend([
+            IfCondition(
+                '(0 <= self->fsm.state) && (self->fsm.state < NUM_STATE)',
+                ['return PyLong_FromLong(self->fsm.state);'],
+            ),
+            'Py_RETURN_NONE;',
+        ])
+        fn_set_state.extend([
+            'long state = INVALID_STATE;',
+            IfCondition('!value', [
+                'PyErr_SetString(PyExc_TypeError, "cannot delete state");',
+                'return -1;',
+            ]),
+            IfCondition('value != Py_None', [
+                'state = PyLong_AsLong(value);',
+                IfCondition(
+                    '(state == -1) && PyErr_Occurred()', ['return -1;'],
+                ),
+                IfCondition('(state < 0) || (NUM_STATE <= state)', [
+                    'PyErr_Format(PyExc_ValueError,'
+                    ' "%ld is not a state", state);',
+                    'return -1;',
+                ]),
+            ]),
+            'self->fsm.state = (int) state;',
+            'return 0;',
+        ])
+        fn_not_implemented.extend([
+            'PyErr_SetNone(PyExc_NotImplementedError);',
+            'return NULL;',
+        ])
+        fn_module_init.extend([
+            'PyObject * module;',
+            'int label;',
+            IfCondition(
+                '(PyType_Ready(&fsm_type) < 0)'
+                ' || (PyType_Ready(&callbacks_type) < 0)',
+                ['return NULL;'],
+            ),
+            'module = PyModule_Create(&module_def);',
+            IfCondition('!module', ['return NULL;']),
+            IfCondition(
+                '(PyModule_AddObjectRef(module, "Fsm",'
+                ' (PyObject *) &fsm_type) < 0)'
+                ' || (PyModule_AddObjectRef(module, "Callbacks",'
+                ' (PyObject *) &callbacks_type) < 0)',
+                ['goto error;'],
+            ),
+            'for (label = 0; label < NUM_STATE; label++) {',
+            '\tif (PyModule_AddIntConstant('
+            'module, state_names[label], label) < 0) {',
+            '\t\tgoto error;',
+            '\t}',
+            '}',
+            'for (label = 0; label < NUM_EVENT; label++) {',
+            '\tif (PyModule_AddIntConstant('
+            'module, event_names[label], label) < 0) {',
+            '\t\tgoto error;',
+            '\t}',
+            '}',
+            'return module;',
+            'error:',
+            'Py_DECREF(module);',
+            'return NULL;',
+        ])
+        ### extension types
+        self._type_callback = type_callback
+        self._type_object = type_object
+        self._type_fastcall = type_fastcall
+        self._type_object_new = type_new
+        self._type_object_init = type_init
+        ### extension functions
+        self._fn_helpers = [
+            fn_call_condition,
+            fn_call_action,
+            fn_ignore_condition,
+            fn_ignore_action,
+        ]
+        self._fn_trampolines = []
+        self._fn_object = [fn_traverse, fn_clear, fn_dealloc]
+        ### statements of the Fsm object initialiser, before those binding
+        ### each callback
+        self._init_statements = init_statements
+        self._init_callbacks = []
+        ### statements of the Fsm object allocator ignoring each callback
+        self._new_callbacks = []
+        self._callback_names = []
+        self._fn_inject = [fn_dispatch, fn_inject]
+        self._fn_injectors = []
+        self._fn_object_others = [
+            fn_inject_events, fn_get_state, fn_set_state, fn_not_implemented,
+        ]
+        self._fn_module_init = fn_module_init
+        ### extension method tables
+        self._methods_fsm = []
+        self._methods_callbacks = []
+    def declare_state(self, state, parent=None):
+        super().declare_state(state, parent)
+        self._states.append(state)
+    def declare_event(self, event):
+        super().declare_event(event)
+        self._events.append(event)
+        injector = Function(
+            f'fsm_inject_{event}', self._type_fastcall, 'static',
+        )
+        injector.append(
+            f'return inject(self, EVENT_{event.upper()}, args, nargs, kwnames);'
+        )
+        self._fn_injectors.append(injector)
+        self._methods_fsm.append(
+            f'{{"inject_{event}",'
+            f' (PyCFunction) (void (*)(void)) {injector.identifier},'
+            ' METH_FASTCALL | METH_KEYWORDS,'
+            f' {_string(f"Inject event {event} with event `arg`")}}}'
+        )
+    def _declare_callback(self, name, kind, fn_ignore, type_):
+        """Declare callback `name` of `kind`, 'condition' or 'action'."""
+        self._type_callback.append(name)
+        self._callback_names.append(name)
+        label = self._type_callback.label_value(name)
+        trampoline = Function(f'call_{name}', type_, 'static')
+        call = f'call_{kind}(fsm, {label}, arg);'
+        trampoline.append('return ' + call if kind == 'condition' else call)
+        self._fn_trampolines.append(trampoline)
+        self._init_callbacks.append(
+            f'self->cb.{name} = self->callables[{label}]'
+            f' ? {trampoline.identifier} : {fn_ignore.identifier};'
+        )
+        self._new_callbacks.append(f'self->cb.{name} = {fn_ignore.identifier};')
+        doc = f'Callback for {self._name} FSM {kind} {name[len(kind) + 1:]}'
+        self._methods_callbacks.append(
+            f'{{{_string(name)}, not_implemented, METH_VARARGS | METH_STATIC,'
+            f' {_string(doc)}}}'
+        )
+    def declare_condition(self, condition):
+        super().declare_condition(condition)
+        self._declare_callback(
+            f'condition_{condition}', 'condition',
+            self._fn_helpers[2], self._type_condition,
+        )
+    def declare_action(self, action):
+        super().declare_action(action)
+        self._declare_callback(
+            f'action_{action}', 'action',
+            self._fn_helpers[3], self._type_action,
+        )
+    def _names_array(self, identifier, labels, dimension):
+        """Return an :class:`Array` of the string names of `labels`."""
+        return Array(
+            identifier, None, 'static const', dimension,
+            elements=[_string(_) for _ in labels], type_name='char * const',
+        )
+    @property
+    def _module_parts(self):
+        """Return a list of the parts of the extension module source.
+
+        Each part is either a string or an object with a `write` method.
+        """
+        prefix = self._name
+        type_object = self._type_object.typedef_name
+        fn_new = Function(
+            'fsm_new', self._type_object_new, 'static', [
+                f'{self._type_object.pointer("self")}'
+                f' = ({type_object} *) type->tp_alloc(type, 0);',
+                IfCondition('!self', ['return NULL;']),
+                Comment(
+                    'until initialised, the FSM is final and ignores each'
+                    ' callback'
+                ),
+                'self->fsm.cb = &self->cb;',
+                'self->fsm.data = self;',
+                'self->fsm.state = INVALID_STATE;',
+            ] + self._new_callbacks + [
+                'return (PyObject *) self;',
+            ],
+        )
+        fn_init = Function(
+            'fsm_init', self._type_object_init, 'static',
+            self._init_statements + self._init_callbacks + [
+                'self->fsm.state = INVALID_STATE;',
+                f'{self._prefix}_init(&self->fsm, &self->cb, self, arg);',
+                IfCondition(
+                    'self->failed', ['self->failed = 0;', 'return -1;'],
+                ),
+                'return 0;',
+            ],
+        )
+        type_callback = self._type_callback
+        methods_fsm = self._methods_fsm + [
+            '{"inject_events",'
+            ' (PyCFunction) (void (*)(void)) fsm_inject_events,'
+            ' METH_VARARGS | METH_KEYWORDS,'
+            ' "Inject each event number in `events` with event `arg`"}',
+        ]
+        return [
+            type_callback.declaration,
+            '',
+            self._type_object.typedef,
+            self._type_object.declaration,
+            '',
+            self._names_array(
+                'callback_names', self._callback_names,
+                type_callback.num_values,
+            ),
+            self._names_array(
+                'state_names', [f'STATE_{_}' for _ in self._states],
+                'NUM_STATE',
+            ),
+            self._names_array(
+                'event_names', [f'EVENT_{_}' for _ in self._events],
+                'NUM_EVENT',
+            ),
+            '',
+        ] + self._fn_helpers + self._fn_trampolines + [
+            '',
+        ] + self._fn_object + [
+            fn_new,
+            fn_init,
+        ] + self._fn_inject + self._fn_injectors + self._fn_object_others + [
+            '',
+            Array(
+                'fsm_methods', None, 'static',
+                elements=methods_fsm + ['{NULL}'], type_name='PyMethodDef',
+            ),
+            Array(
+                'fsm_members', None, 'static', elements=[
+                    '{"callbacks", T_OBJECT, offsetof('
+                    f'{type_object}, callbacks), READONLY,'
+                    f' "The callbacks of this {prefix} FSM instance"}}',
+                    '{"data", T_OBJECT, offsetof('
+                    f'{type_object}, data), 0,'
+                    f' "The data of this {prefix} FSM instance"}}',
+                    '{NULL}',
+                ],
+                type_name='PyMemberDef',
+            ),
+            Array(
+                'fsm_getset', None, 'static', elements=[
+                    '{"state", (getter) fsm_get_state, (setter) fsm_set_state,'
+                    f' "The state of this {prefix} FSM instance,'
+                    ' None if final", NULL}',
+                    '{NULL}',
+                ],
+                type_name='PyGetSetDef',
+            ),
+            self._type_object_definition(
+                'fsm_type', 'Fsm', f'A class for {prefix} FSM instances', [
+                    f'.tp_basicsize = sizeof({type_object}),',
+                    '.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE'
+                    ' | Py_TPFLAGS_HAVE_GC,',
+                    '.tp_weaklistoffset = offsetof('
+                    f'{type_object}, weakreflist),',
+                    '.tp_new = fsm_new,',
+                    '.tp_init = (initproc) fsm_init,',
+                    '.tp_traverse = (traverseproc) fsm_traverse,',
+                    '.tp_clear = (inquiry) fsm_clear,',
+                    '.tp_dealloc = (destructor) fsm_dealloc,',
+                    '.tp_free = PyObject_GC_Del,',
+                    '.tp_methods = fsm_methods,',
+                    '.tp_members = fsm_members,',
+                    '.tp_getset = fsm_getset,',
+                ],
+            ),
+            Array(
+                'callbacks_methods', None, 'static',
+                elements=self._methods_callbacks + ['{NULL}'],
+                type_name='PyMethodDef',
+            ),
+            self._type_object_definition(
+                'callbacks_type', 'Callbacks',
+                f'Interface for {prefix} FSM condition and action callbacks', [
+                    '.tp_basicsize = sizeof(PyObject),',
+                    '.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,',
+                    '.tp_new = PyType_GenericNew,',
+                    '.tp_methods = callbacks_methods,',
+                ],
+            ),
+            '\n'.join([
+                'static struct PyModuleDef module_def = {',
+                '\tPyModuleDef_HEAD_INIT,',
+                f'\t.m_name = "{prefix}_fsm",',
+                '\t.m_doc ='
+                f' "A CPython extension implementation of {prefix} FSM",',
+                '\t.m_size = -1,',
+                '};',
+            ]),
+            '',
+            self._fn_module_init,
+            '',
+            self.eof,
+        ]
+    def _type_object_definition(self, identifier, name, doc, slots):
+        """Return the C definition of a static Python type object."""
+        return '\n'.join([
+            f'static PyTypeObject {identifier} = {{',
+            '\tPyVarObject_HEAD_INIT(NULL, 0)',
+            f'\t.tp_name = "{self._name}_fsm.{name}",',
+            f'\t.tp_doc = {_string(doc)},',
+        ] + [
+            '\t' + _ for _ in slots
+        ] + [
+            '};',
+        ])
+    def write_module(self, fp):
+        """Write the extension module source to file object `fp`."""
+        for (index, part) in enumerate(self._module_parts):
+            if index:
+                fp.write('\n')
+            if isinstance(part, str):
+                fp.write(part)
+            else:
+                part.write(fp)
+    def write(self, fp):
+        """Write the C implementation and extension module to file object `fp`.
+        """
+        fp.write('\n'.join(INCLUDES) + '\n\n')
+        super().write(fp)
+        fp.write('\n')
+        self.write_module(fp)
+    def write_files(self, directory):
+        """Write the C implementation and extension module to `directory`.
+
+        Write the C implementation as :meth:`rsk_fsm.target.c.Implementation.
+        write_files` does, and the extension module source to
+        `<prefix>_module.c`, where `<prefix>` is this implementation's prefix.
+        Return a list of the names of the files written.
+        """
+        names = super().write_files(directory)
+        module = f'{self._prefix}_module.c'
+        with open(
+                os.path.join(directory, module), 'w', encoding='utf-8',
+            ) as fid:
+            fid.write('\n'.join(
+                INCLUDES + (f'#include "{self._prefix}.h"',)
+            ) + '\n\n')
+            self.write_module(fid)
+            fid.write('\n')
+        return names + [module]
+
+class Builder(_Builder):
+    """A builder for target implementation of a FSM as a CPython extension.
+
+    If `jobs` is more than one then build and render the handlers for each
+    event in a pool of `jobs` worker processes.
+    """
+    def __init__(self, prefix, jobs=1, report=None):
+        super().__init__(prefix, dispatch=True, jobs=jobs, report=report)
+    def new_implementation(self):
+        return Implementation(self._prefix)
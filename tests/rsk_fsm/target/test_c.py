@@ -2,12 +2,14 @@
 
 """Test cases for rsk_fsm.target.c"""
 
+from io import StringIO
 from unittest import TestCase
 from nose2.tools import params
 
 from rsk_fsm.target.c import (
     Comment,
     IfCondition,
+    WhileLoop,
     Declarator,
     IndirectDeclarator,
     Type,
@@ -15,6 +17,7 @@ from rsk_fsm.target.c import (
     Enum,
     Struct,
     Function,
+    RenderedFunction,
     Array,
 )
 
@@ -99,6 +102,24 @@ class TestIfCondition(TestCase, metaclass=_TestBuilder):
             ['foo', ['bar = baz;'], False],
             'if (!(foo)) {\n\tbar = baz;\n}',
         ),
+        (
+            ['foo', [IfCondition('bar', ['baz = 1;'])]],
+            'if (foo) {\n\tif (bar) {\n\t\tbaz = 1;\n\t}\n}',
+        ),
+    )
+
+class TestWhileLoop(TestCase, metaclass=_TestBuilder):
+    """Test cases for rsk_fsm.target.c.WhileLoop."""
+    constructor = WhileLoop
+    stringify = (
+        (
+            ['foo', ['bar = baz;', 'baz += 2;']],
+            'while (foo) {\n\tbar = baz;\n\tbaz += 2;\n}',
+        ),
+        (
+            ['foo', [WhileLoop('bar', ['baz++;'])]],
+            'while (foo) {\n\twhile (bar) {\n\t\tbaz++;\n\t}\n}',
+        ),
     )
 
 class TestDeclarator(TestCase, metaclass=_TestBuilder):
@@ -656,6 +677,36 @@ class TestFunction(TestCase, metaclass=_TestBuilder):
                 '}',
             ]),
         )
+    def test_write(self):
+        """Test rsk_fsm.target.c.Function.write"""
+        instance = self.constructor('foo', self.quuz, statements=[
+            IfCondition('bar', ['baz;']),
+        ])
+        fid = StringIO()
+        self.assertIsNone(instance.write(fid))
+        self.assertEqual(
+            fid.getvalue(),
+            '\n'.join([
+                'int foo(void) {',
+                '\tif (bar) {',
+                '\t\tbaz;',
+                '\t}',
+                '}',
+            ]),
+        )
+    def test_render(self):
+        """Test rsk_fsm.target.c.Function.render"""
+        instance = self.constructor('foo', self.quuz, 'static', [
+            IfCondition('bar', ['baz;']),
+        ])
+        rendered = instance.render()
+        self.assertIsInstance(rendered, RenderedFunction)
+        self.assertEqual(rendered.identifier, instance.identifier)
+        self.assertEqual(rendered.prototype, instance.prototype)
+        self.assertEqual(rendered.implementation, instance.implementation)
+        fid = StringIO()
+        self.assertIsNone(rendered.write(fid))
+        self.assertEqual(fid.getvalue(), instance.implementation)
 
 class TestArray(TestCase, metaclass=_TestBuilder):
     """Test cases for rsk_fsm.target.c.Array"""
@@ -683,3 +734,23 @@ class TestArray(TestCase, metaclass=_TestBuilder):
                 '};',
             ]),
         )
+    def test_implementation_type_name(self):
+        """Test rsk_fsm.target.c.Array.implementation with explicit type name"""
+        instance = self.constructor(
+            'foo', None, 'static const', elements=('1', '2'), type_name='int',
+        )
+        self.assertEqual(
+            instance.implementation,
+            '\n'.join([
+                'static const int foo[] = {',
+                '\t1,',
+                '\t2,',
+                '};',
+            ]),
+        )
+    def test_write(self):
+        """Test rsk_fsm.target.c.Array.write"""
+        instance = self.constructor('foo', self.quuz, elements=('bar',))
+        fid = StringIO()
+        self.assertIsNone(instance.write(fid))
+        self.assertEqual(fid.getvalue(), 'quuz_fp foo[] = {\n\tbar,\n};')
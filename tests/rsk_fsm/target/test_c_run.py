@@ -0,0 +1,507 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Test cases compiling and running rsk_fsm.target.c implementations
+
+Each test case builds share/test.fsm with target options, compiles it with a C
+test program and runs the program, as share/test.sh does. A test program exits
+with status 0 and prints its trace, or prints a failure and exits with status
+1. The test cases are skipped if there is no C compiler.
+
+The rsk_fsm.target.pythonc test cases build the extension module, and run a
+Python test script importing it in a child process, so that a crash fails the
+test case rather than the test run.
+"""
+
+import os
+import shutil
+import subprocess
+import sys
+import sysconfig
+
+from tempfile import TemporaryDirectory
+from unittest import (TestCase, skipUnless)
+
+from rsk_fsm import runtime
+from rsk_fsm.target.c import Builder as CBuilder
+from rsk_fsm.target.pythonc import Builder as PythonCBuilder
+
+from .test_target import (TEST_FSM, _decode_test_fsm)
+
+COMPILER = shutil.which(os.environ.get('CC', 'cc')) or shutil.which('gcc')
+PYTHON_H = os.path.join(sysconfig.get_paths()['include'], 'Python.h')
+
+### the C test program prelude: callbacks recording a trace of the actions
+### called, and the state each is called in, and a check failing the program
+PRELUDE = '''\
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test_fsm.h"
+
+#ifndef STATE
+#define STATE(fsm) ((fsm)->state)
+#endif
+
+#define CHECK(expr) do { \\
+	if (!(expr)) { \\
+		printf("FAIL line %d: %s\\n", __LINE__, #expr); \\
+		exit(1); \\
+	} \\
+} while (0)
+
+static int condition = 1;
+
+static int check(test_fsm_t * fsm, void * arg) {
+	(void) fsm;
+	(void) arg;
+	return condition;
+}
+
+#define ACTION(name) \\
+	static void name(test_fsm_t * fsm, void * arg) { \\
+		(void) arg; \\
+		trace(fsm, #name); \\
+	}
+
+static void trace(test_fsm_t * fsm, const char * name);
+
+ACTION(done)
+ACTION(enter_A)
+ACTION(enter_B)
+ACTION(enter_C)
+ACTION(enter_D)
+ACTION(enter_E)
+ACTION(enter_F)
+ACTION(exit_A)
+ACTION(exit_B)
+ACTION(exit_C)
+ACTION(exit_D)
+ACTION(exit_E)
+ACTION(exit_F)
+ACTION(jump)
+
+static test_fsm_cb_t cb = {
+	.condition_check = check,
+	.action_done = done,
+	.action_enter_A = enter_A,
+	.action_enter_B = enter_B,
+	.action_enter_C = enter_C,
+	.action_enter_D = enter_D,
+	.action_enter_E = enter_E,
+	.action_enter_F = enter_F,
+	.action_exit_A = exit_A,
+	.action_exit_B = exit_B,
+	.action_exit_C = exit_C,
+	.action_exit_D = exit_D,
+	.action_exit_E = exit_E,
+	.action_exit_F = exit_F,
+	.action_jump = jump,
+};
+'''
+
+### print each action and the state it is called in
+TRACE = '''
+static void trace(test_fsm_t * fsm, const char * name) {
+	printf("%s %d\\n", name, STATE(fsm));
+}
+'''
+
+### a single-threaded sequence of events through one instance
+SEQUENCE = PRELUDE + TRACE + '''
+int main(void) {
+	test_fsm_t fsm;
+	test_fsm_init(&fsm, &cb, NULL, NULL);
+	test_fsm_inject_X(&fsm, NULL);
+	test_fsm_inject_X(&fsm, NULL);
+	test_fsm_inject_Z(&fsm, NULL);
+	test_fsm_inject_X(&fsm, NULL);
+	test_fsm_inject_Y(&fsm, NULL);
+	test_fsm_inject_Y(&fsm, NULL);
+	printf("final %d\\n", STATE(&fsm));
+	return 0;
+}
+'''
+
+def _compile_run(options, program, *cflags):
+    """Return the output of C `program` with share/test.fsm built with
+    target `options`.
+    """
+    fsm = _decode_test_fsm()
+    with TemporaryDirectory() as directory:
+        CBuilder(fsm['name'], **options).build(fsm).write_files(directory)
+        main = os.path.join(directory, 'main.c')
+        with open(main, 'w', encoding='utf-8') as fid:
+            fid.write(program)
+        binary = os.path.join(directory, 'main')
+        subprocess.run([
+            COMPILER, '-std=c11', '-Wall', '-Wno-unused-parameter', '-Werror',
+            *cflags, '-o', binary, main,
+            os.path.join(directory, 'test_fsm.c'),
+        ], check=True)
+        result = subprocess.run(
+            [binary], capture_output=True, text=True, check=False,
+        )
+    if result.returncode:
+        raise AssertionError(result.stdout + result.stderr)
+    return result.stdout
+
+def _extension_run(script):
+    """Return the output of Python `script` importing the share/test.fsm
+    extension module.
+    """
+    fsm = _decode_test_fsm()
+    with TemporaryDirectory() as directory:
+        PythonCBuilder(fsm['name']).build(fsm).write_files(directory)
+        module = 'test_fsm' + sysconfig.get_config_var('EXT_SUFFIX')
+        subprocess.run([
+            COMPILER, '-shared', '-fPIC', '-Wall', '-Wno-unused-parameter',
+            '-Werror', '-I', os.path.dirname(PYTHON_H),
+            '-o', os.path.join(directory, module),
+            os.path.join(directory, 'test_fsm.c'),
+            os.path.join(directory, 'test_fsm_module.c'),
+        ], check=True)
+        result = subprocess.run(
+            [sys.executable, '-c', script], cwd=directory,
+            capture_output=True, text=True, check=False,
+        )
+    if result.returncode:
+        raise AssertionError(result.stdout + result.stderr)
+    return result.stdout
+
+@skipUnless(COMPILER, 'no C compiler')
+class TestTargetCRunBroadcast(TestCase):
+    """Test cases running rsk_fsm.target.c implementations with broadcast"""
+    def test_broadcast(self):
+        """Test broadcast relinks instances in each state's list"""
+        _compile_run({'broadcast': True}, PRELUDE + '''
+static void trace(test_fsm_t * fsm, const char * name) {
+	(void) fsm;
+	(void) name;
+}
+
+#define NUM 8
+
+static test_fsm_arena_t arena;
+static test_fsm_t fsms[NUM];
+
+/* check each state's list holds exactly the instances in that state */
+static void check_lists(void) {
+	int state;
+	int idx;
+	test_fsm_t * fsm;
+	for (state = 0; state < NUM_STATE; state++) {
+		int members = 0;
+		int expected = 0;
+		for (fsm = arena.members[state]; fsm; fsm = fsm->next) {
+			CHECK(fsm->state == state);
+			CHECK(*fsm->pprev == fsm);
+			members++;
+		}
+		for (idx = 0; idx < NUM; idx++) {
+			expected += fsms[idx].state == state;
+		}
+		CHECK(members == expected);
+	}
+}
+
+int main(void) {
+	int idx;
+	test_fsm_arena_init(&arena);
+	for (idx = 0; idx < NUM; idx++) {
+		test_fsm_init(&fsms[idx], &cb, NULL, &arena, NULL);
+		CHECK(fsms[idx].state == STATE_A_B);
+	}
+	check_lists();
+	for (idx = 0; idx < NUM; idx += 3) {
+		test_fsm_inject_X(&fsms[idx], NULL);
+	}
+	check_lists();
+	/* toggle B and C in each substate of A */
+	test_fsm_broadcast(&arena, STATE_A, EVENT_X, NULL);
+	check_lists();
+	for (idx = 0; idx < NUM; idx++) {
+		CHECK(fsms[idx].state == (idx % 3 ? STATE_A_C : STATE_A_B));
+	}
+	/* a broadcast to a state without instances changes nothing */
+	test_fsm_broadcast(&arena, STATE_D, EVENT_Y, NULL);
+	check_lists();
+	test_fsm_broadcast(&arena, STATE_A, EVENT_Z, NULL);
+	check_lists();
+	for (idx = 0; idx < NUM; idx++) {
+		CHECK(fsms[idx].state == STATE_D_E);
+	}
+	test_fsm_fini(&fsms[0]);
+	CHECK(fsms[0].state == INVALID_STATE);
+	check_lists();
+	test_fsm_broadcast(&arena, STATE_D, EVENT_Y, NULL);
+	check_lists();
+	for (idx = 0; idx < NUM_STATE; idx++) {
+		CHECK(!arena.members[idx]);
+	}
+	return 0;
+}
+''')
+
+@skipUnless(COMPILER, 'no C compiler')
+class TestTargetCRunQueue(TestCase):
+    """Test cases running rsk_fsm.target.c implementations with a queue"""
+    def test_run_to_completion(self):
+        """Test events injected by actions are handled after the transition"""
+        output = _compile_run({'queue': 4}, PRELUDE + '''
+static int budget;
+static int inject;
+
+static void trace(test_fsm_t * fsm, const char * name) {
+	printf("%s %d\\n", name, fsm->state);
+	while (name[0] == 'j' && inject && budget) {
+		budget--;
+		test_fsm_inject_X(fsm, NULL);
+	}
+}
+
+int main(void) {
+	test_fsm_t fsm;
+	test_fsm_init(&fsm, &cb, NULL, NULL);
+	/* each jump injects X once more, twice */
+	inject = 1;
+	budget = 2;
+	test_fsm_inject_X(&fsm, NULL);
+	CHECK(fsm.queued == 0 && fsm.dropped == 0 && !fsm.busy);
+	/* a jump injecting more events than the queue holds drops the rest */
+	budget = 6;
+	inject = 1;
+	test_fsm_inject_X(&fsm, NULL);
+	printf("dropped %u\\n", fsm.dropped);
+	CHECK(fsm.queued == 0 && !fsm.busy);
+	return 0;
+}
+''')
+        lines = output.splitlines()
+        # three transitions from X, each completing before the next starts
+        self.assertEqual(lines[:11], [
+            'enter_A 0', 'enter_B 1',
+            'exit_B 1', 'jump 1', 'enter_C 2',
+            'exit_C 2', 'jump 2', 'enter_B 1',
+            'exit_B 1', 'jump 1', 'enter_C 2',
+        ])
+        self.assertEqual(lines[-1], 'dropped 2')
+
+@skipUnless(COMPILER, 'no C compiler')
+class TestTargetCRunMailbox(TestCase):
+    """Test cases running rsk_fsm.target.c implementations with a mailbox"""
+    def test_post_receive(self):
+        """Test events posted by several threads are each received once"""
+        output = _compile_run({'mailbox': 8}, '''\
+#define _POSIX_C_SOURCE 200809L
+''' + PRELUDE + '''
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#define THREADS 4
+#define POSTS 1000
+
+static long jumps;
+static test_fsm_t fsm;
+static atomic_int posting = THREADS;
+
+static void trace(test_fsm_t * fsm, const char * name) {
+	(void) fsm;
+	jumps += name[0] == 'j';
+}
+
+static void * poster(void * data) {
+	int posted;
+	(void) data;
+	for (posted = 0; posted < POSTS; posted++) {
+		while (test_fsm_post_X(&fsm, NULL)) {
+			/* full */
+			sched_yield();
+		}
+	}
+	atomic_fetch_sub(&posting, 1);
+	return NULL;
+}
+
+int main(void) {
+	pthread_t threads[THREADS];
+	long received = 0;
+	int idx;
+	test_fsm_init(&fsm, &cb, NULL, NULL);
+	/* a full mailbox refuses a post */
+	for (idx = 0; idx < 8; idx++) {
+		CHECK(!test_fsm_post_X(&fsm, NULL));
+	}
+	CHECK(test_fsm_post_X(&fsm, NULL));
+	CHECK(test_fsm_receive(&fsm) == 8);
+	CHECK(test_fsm_receive(&fsm) == 0);
+	for (idx = 0; idx < THREADS; idx++) {
+		CHECK(!pthread_create(&threads[idx], NULL, poster, NULL));
+	}
+	while (atomic_load(&posting)) {
+		int handled = test_fsm_receive(&fsm);
+		if (!handled) {
+			sched_yield();
+		}
+		received += handled;
+	}
+	received += test_fsm_receive(&fsm);
+	for (idx = 0; idx < THREADS; idx++) {
+		pthread_join(threads[idx], NULL);
+	}
+	printf("received %ld jumps %ld state %d\\n", received, jumps, fsm.state);
+	return 0;
+}
+''', '-pthread')
+        # each X toggles B and C with one jump
+        self.assertEqual(
+            output, 'received 4000 jumps 4008 state 1\n',
+        )
+    def test_receive_batch(self):
+        """Test events posted by number are received in batches"""
+        options = {'mailbox': 8, 'dispatch': True}
+        output = _compile_run(options, PRELUDE + TRACE + '''
+int main(void) {
+	test_fsm_t fsm;
+	test_fsm_init(&fsm, &cb, NULL, NULL);
+	/* an event out of range is refused */
+	CHECK(test_fsm_post(&fsm, NUM_EVENT, NULL));
+	CHECK(!test_fsm_post(&fsm, EVENT_X, NULL));
+	CHECK(!test_fsm_post(&fsm, EVENT_X, NULL));
+	CHECK(!test_fsm_post(&fsm, EVENT_Y, NULL));
+	CHECK(test_fsm_receive_batch(&fsm, 2) == 2);
+	printf("batch %d\\n", STATE(&fsm));
+	CHECK(test_fsm_receive_batch(&fsm, 2) == 1);
+	CHECK(test_fsm_receive_batch(&fsm, 2) == 0);
+	printf("final %d\\n", STATE(&fsm));
+	return 0;
+}
+''')
+        # the first batch is both X, the second Y, unhandled in B
+        self.assertEqual(output.splitlines(), [
+            'enter_A 0', 'enter_B 1',
+            'exit_B 1', 'jump 1', 'enter_C 2',
+            'exit_C 2', 'jump 2', 'enter_B 1',
+            'batch 1',
+            'final 1',
+        ])
+
+@skipUnless(COMPILER, 'no C compiler')
+class TestTargetCRunExecutor(TestCase):
+    """Test cases running rsk_fsm.target.c implementations in the executor"""
+    def test_executor(self):
+        """Test share/test_executor.c handles each event posted, in order"""
+        with open(
+                os.path.join(os.path.dirname(TEST_FSM), 'test_executor.c'),
+                encoding='utf-8',
+            ) as fid:
+            program = fid.read()
+        output = _compile_run(
+            {'mailbox': 64, 'dispatch': True},
+            '#define _POSIX_C_SOURCE 200809L\n' + program,
+            '-pthread', f'-I{runtime.path()}',
+            os.path.join(runtime.path(), 'rsk_fsm_executor.c'),
+        )
+        self.assertEqual(
+            output.splitlines()[-1], 'PASS: dispatched 40000 of 40000 events',
+        )
+
+@skipUnless(COMPILER, 'no C compiler')
+class TestTargetCRunAtomic(TestCase):
+    """Test cases running rsk_fsm.target.c implementations with atomic state
+    """
+    def test_sequence(self):
+        """Test actions see the same states with and without atomic state"""
+        self.assertEqual(
+            _compile_run(
+                {'atomic': True}, SEQUENCE, '-DSTATE(fsm)=test_fsm_state(fsm)',
+            ),
+            _compile_run({}, SEQUENCE),
+        )
+    def test_threads(self):
+        """Test events injected by several threads into a shared instance"""
+        output = _compile_run({'atomic': True}, PRELUDE + '''
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define THREADS 4
+#define INJECTS 10000
+
+static atomic_long jumps;
+static test_fsm_t fsm;
+
+static void trace(test_fsm_t * fsm, const char * name) {
+	int state = test_fsm_state(fsm);
+	CHECK((-1 <= state) && (state <= 5));
+	if (name[0] == 'j') {
+		atomic_fetch_add(&jumps, 1);
+	}
+}
+
+static void * injector(void * data) {
+	int injected;
+	(void) data;
+	for (injected = 0; injected < INJECTS; injected++) {
+		test_fsm_inject_X(&fsm, NULL);
+		/* in A_B or A_C */
+		CHECK(test_fsm_state(&fsm) == 1 || test_fsm_state(&fsm) == 2);
+	}
+	return NULL;
+}
+
+int main(void) {
+	pthread_t threads[THREADS];
+	int idx;
+	test_fsm_init(&fsm, &cb, NULL, NULL);
+	for (idx = 0; idx < THREADS; idx++) {
+		CHECK(!pthread_create(&threads[idx], NULL, injector, NULL));
+	}
+	for (idx = 0; idx < THREADS; idx++) {
+		pthread_join(threads[idx], NULL);
+	}
+	printf("jumps %ld state %d\\n", atomic_load(&jumps), test_fsm_state(&fsm));
+	return 0;
+}
+''', '-pthread')
+        # each X toggles B and C with one jump, under the instance lock
+        self.assertEqual(output, 'jumps 40000 state 1\n')
+
+@skipUnless(COMPILER, 'no C compiler')
+@skipUnless(os.path.exists(PYTHON_H), 'no Python headers')
+class TestTargetPythonCRun(TestCase):
+    """Test cases running rsk_fsm.target.pythonc implementations"""
+    def test_uninitialised(self):
+        """Test an Fsm not initialised is final and ignores each event"""
+        output = _extension_run('''
+import test_fsm
+class Fsm(test_fsm.Fsm):
+    def __init__(self):
+        pass
+fsm = Fsm()
+for event in 'XYZ':
+    getattr(fsm, f'inject_{event}')()
+print(fsm.state)
+for state in range(test_fsm.STATE_D_F + 1):
+    for event in 'XYZ':
+        fsm = test_fsm.Fsm.__new__(test_fsm.Fsm)
+        fsm.state = state
+        getattr(fsm, f'inject_{event}')(arg=0)
+        fsm.inject_events(b'\\x00\\x01\\x02')
+print('done')
+''')
+        # an Fsm set in any state handles each event without callbacks
+        self.assertEqual(output, 'None\ndone\n')
+    def test_weakref(self):
+        """Test an Fsm is weakly referenceable"""
+        output = _extension_run('''
+import gc
+import weakref
+import test_fsm
+fsm = test_fsm.Fsm()
+ref = weakref.ref(fsm)
+print(ref() is fsm)
+del fsm
+gc.collect()
+print(ref())
+''')
+        self.assertEqual(output, 'True\nNone\n')
@@ -2,15 +2,28 @@
 
 """Test cases for rsk_fsm.target builder implementations"""
 
+import asyncio
+import json
 import os
+import weakref
 
-from unittest import TestCase
+from io import StringIO
+from tempfile import TemporaryDirectory
+from unittest import (TestCase, skipUnless)
 
 from rsk_mt.jsonschema.schema import (RootSchema, Support)
 
 from rsk_fsm.build import (Fsm, State, Transition)
+from rsk_fsm.report import Report
 from rsk_fsm.target.c import Builder as CBuilder
+from rsk_fsm.target.ir import Builder as IRBuilder
 from rsk_fsm.target.python import Builder as PythonBuilder
+from rsk_fsm.target.pythonc import Builder as PythonCBuilder
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
 
 SCHEMA_FILE = '/usr/share/json-schema/rsk-fsm/fsm.json'
 
@@ -32,15 +45,51 @@ TEST_FSM = os.path.join(PACKAGE_DIR, 'share/test.fsm')
 TEST_OUT_C = os.path.join(PACKAGE_DIR, 'share/test_fsm.out')
 TEST_OUT_PY = os.path.join(PACKAGE_DIR, 'share/test_fsm.py')
 
-def _build(testcase):
-    """Return target implementation of share/test.fsm for `testcase` builder"""
+def _decode_test_fsm(spec=None):
+    """Return share/test.fsm, or FSM specification text `spec`, decoded"""
     # do not enforce formats, not under test
     schema = RootSchema.load(SCHEMA_FILE, support=Support(bases=BASES))
-    with open(TEST_FSM, encoding='utf-8') as fid:
-        fsm = schema.decode(fid.read())
+    if spec is None:
+        with open(TEST_FSM, encoding='utf-8') as fid:
+            spec = fid.read()
+    return schema.decode(spec)
+
+def _build_implementation(testcase):
+    """Return target implementation object of share/test.fsm for `testcase`"""
+    fsm = _decode_test_fsm()
     builder = testcase.get_builder(fsm['name'])
-    implementation = builder.build(fsm)
-    return str(implementation)
+    return builder.build(fsm)
+
+def _build(testcase):
+    """Return target implementation of share/test.fsm for `testcase` builder"""
+    return str(_build_implementation(testcase))
+
+def _build_ir(testcase):
+    """Return target implementation of share/test.fsm built from IR"""
+    fsm = _decode_test_fsm()
+    ir = json.loads(str(IRBuilder(fsm['name']).build(fsm)))
+    builder = testcase.get_builder(ir['name'])
+    # building from IR does not modify it, so it may be built from again
+    return (str(builder.build_ir(ir)), str(builder.build_ir(ir)))
+
+def _write(testcase):
+    """Return target implementation of share/test.fsm written to a file"""
+    fsm = _decode_test_fsm()
+    builder = testcase.get_builder(fsm['name'])
+    fid = StringIO()
+    builder.build(fsm).write(fid)
+    return fid.getvalue()
+
+def _write_files(testcase):
+    """Return a dict of file name to contents of files written for testcase"""
+    fsm = _decode_test_fsm()
+    builder = testcase.get_builder(fsm['name'])
+    files = {}
+    with TemporaryDirectory() as directory:
+        for name in builder.build(fsm).write_files(directory):
+            with open(os.path.join(directory, name), encoding='utf-8') as fid:
+                files[name] = fid.read()
+    return files
 
 class TestTargetCBuilder(TestCase):
     """Test cases for rsk_fsm.target.c.Builder"""
@@ -58,6 +107,325 @@ class TestTargetCBuilder(TestCase):
     def test_build(self):
         """Test rsk_fsm.target.c.Builder builds share/test.fsm"""
         self.assertEqual(_build(self), self.get_output())
+    def test_write(self):
+        """Test rsk_fsm.target.c.Builder writes share/test.fsm"""
+        self.assertEqual(_write(self), self.get_output())
+    def test_build_ir(self):
+        """Test rsk_fsm.target.c.Builder builds share/test.fsm from IR"""
+        self.assertEqual(_build_ir(self), (self.get_output(),) * 2)
+    def test_write_files(self):
+        """Test rsk_fsm.target.c.Builder writes share/test.fsm files"""
+        (header, source) = self.get_output().split('/* EOF */\n', 1)
+        self.assertEqual(_write_files(self), {
+            'test_fsm.h': header + '/* EOF */\n',
+            'test_fsm.c': '#include "test_fsm.h"\n\n' + source + '\n',
+        })
+
+class TestTargetCBuilderJobs(TestTargetCBuilder):
+    """Test cases for rsk_fsm.target.c.Builder with worker processes"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, jobs=2)
+
+class TestTargetCBuilderStream(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder streaming handlers"""
+    def test_write(self):
+        """Test rsk_fsm.target.c.Builder writes handlers as it builds them"""
+        log = []
+        class Builder(CBuilder):
+            """A builder logging each event whose handlers are built"""
+            def map_events(self, function, events):
+                for (event, result) in zip(
+                        events, super().map_events(function, events),
+                    ):
+                    log.append(f'build {event}')
+                    yield result
+        class Stream(StringIO):
+            """A file object logging each handler written"""
+            def write(self, s):
+                if s.startswith('void handle_'):
+                    log.append('write ' + s.split('(', 1)[0].split('_')[1])
+                return super().write(s)
+        self.get_builder = Builder
+        implementation = _build_implementation(self)
+        self.assertEqual(log, [])
+        fid = Stream()
+        implementation.write(fid)
+        self.assertEqual(log, [
+            'build X', 'write X', 'write X', 'write X', 'write X',
+            'build Y', 'write Y', 'write Y', 'write Y', 'write Y',
+            'build Z', 'write Z', 'write Z', 'write Z',
+        ])
+        self.assertEqual(fid.getvalue(), _write(TestTargetCBuilder()))
+    def test_report(self):
+        """Test rsk_fsm.target.c.Builder builds handlers before writing them
+        when reporting
+        """
+        log = []
+        class Builder(CBuilder):
+            """A builder logging each event whose handlers are built"""
+            def map_events(self, function, events):
+                for (event, result) in zip(
+                        events, super().map_events(function, events),
+                    ):
+                    log.append(event)
+                    yield result
+        self.get_builder = lambda prefix: Builder(prefix, report=Report(prefix))
+        implementation = _build_implementation(self)
+        # the transitions are flattened, then the handlers built
+        self.assertEqual(log, ['X', 'Y', 'Z'] * 2)
+        fid = StringIO()
+        implementation.write(fid)
+        self.assertEqual(log, ['X', 'Y', 'Z'] * 2)
+        self.assertEqual(fid.getvalue(), _write(TestTargetCBuilder()))
+
+class TestTargetCBuilderShards(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with shards"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, shards=2)
+    def test_write_files(self):
+        """Test rsk_fsm.target.c.Builder writes share/test.fsm shards"""
+        files = _write_files(self)
+        self.assertEqual(sorted(files), [
+            'test_fsm.c',
+            'test_fsm.h',
+            'test_fsm_0.c',
+            'test_fsm_1.c',
+            'test_fsm_impl.h',
+        ])
+        self.assertIn(
+            'extern void test_fsm_handle_X_in_A_B('
+            'test_fsm_t * fsm, void * arg);',
+            files['test_fsm_impl.h'],
+        )
+        self.assertIn(
+            '\nvoid test_fsm_handle_X_in_A_B(test_fsm_t * fsm, void * arg) {',
+            files['test_fsm_0.c'],
+        )
+        self.assertIn(
+            '\nvoid test_fsm_handle_Z_in_A_C(test_fsm_t * fsm, void * arg) {',
+            files['test_fsm_1.c'],
+        )
+        for name in ('test_fsm.c', 'test_fsm_0.c', 'test_fsm_1.c'):
+            self.assertTrue(files[name].startswith(
+                '#include "test_fsm.h"\n#include "test_fsm_impl.h"\n\n'
+            ))
+        self.assertNotIn('handle_X_in_A_B(test_fsm_t', files['test_fsm.c'])
+        self.assertTrue(files['test_fsm_impl.h'].startswith(
+            '#ifndef TEST_FSM_IMPL_H\n#define TEST_FSM_IMPL_H\n\n'
+        ))
+        self.assertTrue(files['test_fsm_impl.h'].endswith(
+            '\n#endif\n\n/* EOF */\n'
+        ))
+    def test_write(self):
+        """Test rsk_fsm.target.c.Builder cannot write shards to one file"""
+        with self.assertRaises(ValueError):
+            _write(self)
+
+class TestTargetCBuilderShardsClamped(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with more shards than handlers"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, shards=20)
+    def test_write_files(self):
+        """Test rsk_fsm.target.c.Builder writes no more shards than handlers"""
+        files = _write_files(self)
+        shards = sorted(_ for _ in files if _[len('test_fsm_'):-2].isdigit())
+        self.assertEqual(shards, sorted(f'test_fsm_{_}.c' for _ in range(11)))
+        for name in shards:
+            self.assertEqual(files[name].count('\nvoid test_fsm_handle_'), 1)
+
+class TestTargetCBuilderBroadcast(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with broadcast"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, broadcast=True)
+    def test_build(self):
+        """Test rsk_fsm.target.c.Builder builds share/test.fsm with broadcast"""
+        (header, source) = _build(self).split('/* EOF */\n', 1)
+        self.assertIn(
+            'extern void test_fsm_broadcast(test_fsm_arena_t * arena,'
+            ' int state, int event, void * arg);',
+            header,
+        )
+        self.assertIn('enum state_tag {', header)
+        self.assertNotIn('enum state_tag {', source)
+        # every state store outside set_state maintains arena membership
+        self.assertEqual(source.count('fsm->state = '), 1)
+
+class TestTargetCBuilderQueue(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with event queue"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, queue=8)
+    def test_build(self):
+        """Test rsk_fsm.target.c.Builder builds share/test.fsm with queue"""
+        (header, source) = _build(self).split('/* EOF */\n', 1)
+        self.assertIn('\ttest_fsm_event_t queue[8];', header)
+        for event in ('X', 'Y', 'Z'):
+            self.assertIn(
+                f'void test_fsm_inject_{event}(test_fsm_t * fsm, void * arg) {{'
+                f'\n\tdispatch(fsm, EVENT_{event}, arg);\n}}',
+                source,
+            )
+    def test_negative(self):
+        """Test rsk_fsm.target.c.Builder rejects negative queue capacity"""
+        with self.assertRaises(ValueError):
+            CBuilder('test', queue=-1).build_implementation()
+
+class TestTargetCBuilderMailbox(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with mailbox"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, mailbox=16)
+    def test_build(self):
+        """Test rsk_fsm.target.c.Builder builds share/test.fsm with mailbox"""
+        (header, source) = _build(self).split('/* EOF */\n', 1)
+        self.assertTrue(header.startswith(
+            '#include <limits.h>\n#include <stdatomic.h>\n',
+        ))
+        self.assertIn('\ttest_fsm_mail_t mailbox[16];', header)
+        self.assertIn(
+            'extern int test_fsm_post_X(test_fsm_t * fsm, void * arg);',
+            header,
+        )
+        self.assertIn(
+            'extern unsigned test_fsm_receive(test_fsm_t * fsm);',
+            header,
+        )
+        self.assertIn('static int post(', source)
+        self.assertIn('static unsigned receive(', source)
+        self.assertNotIn('test_fsm_receive_batch', header)
+    def test_not_power_of_2(self):
+        """Test rsk_fsm.target.c.Builder rejects bad mailbox capacity"""
+        for capacity in (-1, 3, 12):
+            with self.assertRaises(ValueError):
+                CBuilder('test', mailbox=capacity).build_implementation()
+
+class TestTargetCBuilderDispatch(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with dispatch"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, dispatch=True)
+    def test_build(self):
+        """Test rsk_fsm.target.c.Builder builds share/test.fsm with dispatch"""
+        (header, source) = _build(self).split('/* EOF */\n', 1)
+        self.assertIn('\tNUM_EVENT = 3', header)
+        self.assertIn(
+            'extern void test_fsm_dispatch('
+            'void * instance, int event, void * arg);',
+            header,
+        )
+        self.assertIn('transition_on_event[NUM_EVENT]', source)
+
+class TestTargetCBuilderMailboxDispatch(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with mailbox and dispatch"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, mailbox=16, dispatch=True)
+    def test_build(self):
+        """Test rsk_fsm.target.c.Builder builds share/test.fsm for the executor
+        """
+        header = _build(self).split('/* EOF */\n', 1)[0]
+        self.assertIn(
+            'extern int test_fsm_post(void * instance, int event, void * arg);',
+            header,
+        )
+        self.assertIn(
+            'extern unsigned test_fsm_receive_batch(void * instance,'
+            ' unsigned batch);',
+            header,
+        )
+
+class TestTargetCBuilderReplay(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with a replay driver"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, replay=True)
+    def test_write_files(self):
+        """Test rsk_fsm.target.c.Builder writes share/test.fsm replay driver"""
+        files = _write_files(self)
+        self.assertEqual(sorted(files), [
+            'test_fsm.c',
+            'test_fsm.h',
+            'test_fsm_replay.c',
+        ])
+        self.assertIn(
+            'extern void test_fsm_dispatch('
+            'void * instance, int event, void * arg);',
+            files['test_fsm.h'],
+        )
+        driver = files['test_fsm_replay.c']
+        self.assertIn('#include "rsk_fsm_replay.h"\n', driver)
+        self.assertIn('\t.condition_check = replay_condition,\n', driver)
+        self.assertIn('\t.action_jump = replay_action,\n', driver)
+        self.assertIn('\t"A_B",\n', driver)
+        self.assertIn('\t.dispatch = replay_dispatch,\n', driver)
+        self.assertIn(
+            'return rsk_fsm_replay_main(argc, argv, &replay_fsm);', driver,
+        )
+    def test_write(self):
+        """Test rsk_fsm.target.c.Builder cannot write a replay driver to one
+        file
+        """
+        with self.assertRaises(ValueError):
+            _write(self)
+    def test_incompatible(self):
+        """Test rsk_fsm.target.c.Builder rejects replay broadcast"""
+        with self.assertRaises(ValueError):
+            CBuilder('test', replay=True, broadcast=True).build_implementation()
+
+class TestTargetCBuilderAtomic(TestCase):
+    """Test cases for rsk_fsm.target.c.Builder with atomic state"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return CBuilder(prefix, atomic=True)
+    def test_build(self):
+        """Test rsk_fsm.target.c.Builder builds share/test.fsm with atomic"""
+        (header, source) = _build(self).split('/* EOF */\n', 1)
+        self.assertTrue(header.startswith('#include <stdatomic.h>\n'))
+        self.assertIn('\tatomic_int state;', header)
+        self.assertIn('static void transit(', source)
+        self.assertIn(
+            'transit(fsm, transition_on_event_X, commit_on_event_X, arg);',
+            source,
+        )
+        self.assertNotIn('fsm->state = ', source)
+        self.assertIn(
+            'extern int test_fsm_state(const test_fsm_t * fsm);', header,
+        )
+        self.assertIn(
+            'return state < NUM_STATE ? state : state - NUM_STATE - 1;', source,
+        )
+        # intermediate states are stored locked, as they are stored unlocked
+        # without atomic state
+        self.assertIn(
+            'atomic_store_explicit(&fsm->state, STATE_D + NUM_STATE + 1,'
+            ' memory_order_release);',
+            source,
+        )
+        # the state is initialised before any enter action is called
+        init = source[source.index('\nvoid test_fsm_init('):]
+        self.assertLess(
+            init.index('atomic_init(&fsm->state,'),
+            init.index('fsm->cb->action_enter_A('),
+        )
+    def test_incompatible(self):
+        """Test rsk_fsm.target.c.Builder rejects atomic broadcast or queue"""
+        for options in ({'broadcast': True}, {'queue': 4}):
+            with self.assertRaises(ValueError):
+                CBuilder('test', atomic=True, **options).build_implementation()
 
 class TestTargetPythonBuilder(TestCase):
     """Test cases for rsk_fsm.target.python.Builder"""
@@ -75,3 +443,288 @@ class TestTargetPythonBuilder(TestCase):
     def test_build(self):
         """Test rsk_fsm.target.python.Builder builds share/test.fsm"""
         self.assertEqual(_build(self), self.get_output())
+    def test_write(self):
+        """Test rsk_fsm.target.python.Builder writes share/test.fsm"""
+        self.assertEqual(_write(self), self.get_output())
+    def test_build_ir(self):
+        """Test rsk_fsm.target.python.Builder builds share/test.fsm from IR"""
+        self.assertEqual(_build_ir(self), (self.get_output(),) * 2)
+    def test_write_files(self):
+        """Test rsk_fsm.target.python.Builder writes share/test.fsm files"""
+        self.assertEqual(_write_files(self), {
+            'test_fsm.py': self.get_output() + '\n',
+        })
+    def test_slots(self):
+        """Test rsk_fsm.target.python.Builder instances are weakly referenceable
+        """
+        fsm = _decode_test_fsm()
+        class Callbacks(): # pylint: disable=too-few-public-methods
+            """Callbacks doing nothing"""
+            def __getattr__(self, name):
+                return lambda fsm, arg: None
+        for options in ({}, {'match': True}, {'asyncio': True}):
+            namespace = {}
+            exec( # pylint: disable=exec-used
+                str(PythonBuilder(fsm['name'], **options).build(fsm)),
+                namespace,
+            )
+            instance = namespace['Fsm'](Callbacks())
+            self.assertIs(weakref.ref(instance)(), instance)
+            with self.assertRaises(AttributeError):
+                instance.other = None
+
+class TestTargetPythonBuilderJobs(TestTargetPythonBuilder):
+    """Test cases for rsk_fsm.target.python.Builder with worker processes"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return PythonBuilder(prefix, jobs=2)
+
+class TestTargetPythonBuilderVectorise(TestCase):
+    """Test cases for rsk_fsm.target.python.Builder with vectorise"""
+    fsm = {
+        'name': 'free',
+        'initial': 'A',
+        'states': [
+            {
+                'state': 'A',
+                'initial': 'B',
+                'states': [
+                    {'state': 'B', 'transitions': [
+                        {'event': 'go', 'next': 'C'},
+                    ]},
+                    {'state': 'C', 'transitions': [
+                        {'event': 'go', 'next': 'B'},
+                    ]},
+                ],
+                'transitions': [{'event': 'reset', 'next': '/A'}],
+            },
+            {'state': 'D', 'transitions': [{'event': 'stop'}]},
+        ],
+    }
+    def _build(self):
+        """Return the vectorised source of the FSM to test"""
+        fsm = _decode_test_fsm(json.dumps(self.fsm))
+        return str(PythonBuilder('free', vectorise=True).build(fsm))
+    def test_build(self):
+        """Test rsk_fsm.target.python.Builder builds a vectorised FSM"""
+        source = self._build()
+        self.assertIn('\nimport numpy\n', source)
+        self.assertIn('\nINITIAL_STATE = STATE_A_B\n', source)
+        self.assertIn('\n'.join((
+            'NEXT_STATE = numpy.array([',
+            '    [0, 2, 1, 3, -1], # EVENT_go',
+            '    [1, 1, 1, 3, -1], # EVENT_reset',
+            '    [0, 1, 2, 3, -1], # EVENT_stop',
+            '], dtype=numpy.int8)',
+        )), source)
+        self.assertIn('    return NEXT_STATE[events, states]\n', source)
+    @skipUnless(numpy, 'no NumPy')
+    def test_step(self):
+        """Test the vectorised step function steps each instance"""
+        namespace = {}
+        exec(self._build(), namespace) # pylint: disable=exec-used
+        step = namespace['step']
+        final = namespace['FINAL_STATE']
+        go = namespace['EVENT_go']
+        reset = namespace['EVENT_reset']
+        stop = namespace['EVENT_stop']
+        # an instance in each state, including the final state
+        states = numpy.array([
+            namespace['STATE_A'], namespace['STATE_A_B'],
+            namespace['STATE_A_C'], namespace['STATE_D'], final,
+        ])
+        self.assertEqual(step(states, go).tolist(), [0, 2, 1, 3, final])
+        self.assertEqual(step(states, reset).tolist(), [1, 1, 1, 3, final])
+        self.assertEqual(
+            step(states, numpy.array([go, go, reset, stop, go])).tolist(),
+            [0, 2, 1, 3, final],
+        )
+        # stepping instances from the initial state
+        states = numpy.full(3, namespace['INITIAL_STATE'])
+        for events in ([go, go, go], [go, reset, stop], [go, go, go]):
+            states = step(states, numpy.array(events))
+        self.assertEqual(states.tolist(), [2, 2, 1])
+    def test_incompatible(self):
+        """Test rsk_fsm.target.python.Builder rejects vectorising actions"""
+        fsm = _decode_test_fsm()
+        with self.assertRaises(ValueError):
+            PythonBuilder(fsm['name'], vectorise=True).build(fsm)
+
+class TestTargetPythonBuilderAsyncio(TestCase):
+    """Test cases for rsk_fsm.target.python.Builder with asyncio"""
+    @staticmethod
+    def _load(**kwargs):
+        """Return a namespace of share/test.fsm built with `kwargs`"""
+        fsm = _decode_test_fsm()
+        namespace = {}
+        exec( # pylint: disable=exec-used
+            str(PythonBuilder(fsm['name'], **kwargs).build(fsm)), namespace,
+        )
+        return namespace
+    def test_build(self):
+        """Test rsk_fsm.target.python.Builder builds share/test.fsm for
+        asyncio
+        """
+        events = 'XXZXYZXXZYXZ'
+        def callbacks(trace, asynchronous):
+            """Return a callbacks object recording calls in `trace`"""
+            class Callbacks(): # pylint: disable=too-few-public-methods
+                """Callbacks returning awaitables if `asynchronous`"""
+                checks = 0
+                def __getattr__(self, name):
+                    def callback(fsm, arg):
+                        trace.append((name, fsm.state, arg))
+                        if name.startswith('condition_'):
+                            self.checks += 1
+                            result = self.checks % 3 == 0
+                        else:
+                            result = None
+                        if not asynchronous:
+                            return result
+                        async def awaitable():
+                            await asyncio.sleep(0)
+                            return result
+                        return awaitable()
+                    return callback
+            return Callbacks()
+        expected = []
+        fsm = self._load()['Fsm'](callbacks(expected, False), arg=0)
+        for (arg, event) in enumerate(events, 1):
+            getattr(fsm, f'inject_{event}')(arg)
+        async def main(asynchronous):
+            trace = []
+            fsm = self._load(asyncio=True)['Fsm'](
+                callbacks(trace, asynchronous), arg=0,
+            )
+            for (arg, event) in enumerate(events, 1):
+                getattr(fsm, f'inject_{event}')(arg)
+            # nothing is processed until awaited
+            self.assertEqual(trace, [])
+            await fsm.process()
+            return (trace, fsm.state)
+        for asynchronous in (False, True):
+            self.assertEqual(
+                asyncio.run(main(asynchronous)),
+                (expected, fsm.state),
+            )
+
+class TestTargetPythonBuilderMatch(TestCase):
+    """Test cases for rsk_fsm.target.python.Builder with match"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return PythonBuilder(prefix, match=True)
+    def test_build(self):
+        """Test rsk_fsm.target.python.Builder builds share/test.fsm with
+        match
+        """
+        source = _build(self)
+        self.assertNotIn('TRANSITION_ON_EVENT_', source)
+        self.assertIn('        match (self.state, event):\n', source)
+        self.assertIn("            case (1, 'X'): # STATE_A_B\n", source)
+        self.assertIn("        self.inject('Z', arg)", source)
+        trace = []
+        class Callbacks(): # pylint: disable=too-few-public-methods
+            """Callbacks recording each call"""
+            def __getattr__(self, name):
+                def callback(fsm, arg):
+                    trace.append((name, fsm.state, arg))
+                    return arg % 2
+                return callback
+        traces = []
+        for source in (_build(TestTargetPythonBuilder), source):
+            namespace = {}
+            exec(source, namespace) # pylint: disable=exec-used
+            fsm = namespace['Fsm'](Callbacks(), arg=0)
+            for (arg, event) in enumerate('XXZXZYXYZX'):
+                getattr(fsm, f'inject_{event}')(arg)
+            traces.append((list(trace), fsm.state))
+            trace.clear()
+        self.assertEqual(traces[0], traces[1])
+    def test_incompatible(self):
+        """Test rsk_fsm.target.python.Builder rejects match with asyncio"""
+        fsm = _decode_test_fsm()
+        with self.assertRaises(ValueError):
+            PythonBuilder(fsm['name'], match=True, asyncio=True).build(fsm)
+
+class TestTargetPythonCBuilder(TestCase):
+    """Test cases for rsk_fsm.target.pythonc.Builder"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return PythonCBuilder(prefix)
+    def test_build(self):
+        """Test rsk_fsm.target.pythonc.Builder builds share/test.fsm"""
+        output = _build(self)
+        self.assertTrue(output.startswith(
+            '#define PY_SSIZE_T_CLEAN\n#include <Python.h>\n'
+        ))
+        # the C implementation, with dispatch, precedes the extension module
+        fsm = _decode_test_fsm()
+        c_output = str(CBuilder('test', dispatch=True).build(fsm))
+        self.assertIn(c_output + '\nenum callback_tag {', output)
+        self.assertIn('\nPyMODINIT_FUNC PyInit_test_fsm(void) {', output)
+        self.assertIn(
+            '{"inject_X", (PyCFunction) (void (*)(void)) fsm_inject_X,'
+            ' METH_FASTCALL | METH_KEYWORDS,'
+            ' "Inject event X with event `arg`"}',
+            output,
+        )
+        self.assertIn(
+            'self->cb.action_jump = self->callables[CALLBACK_ACTION_JUMP]'
+            ' ? call_action_jump : ignore_action;',
+            output,
+        )
+        # building again does not repeat statements
+        self.assertEqual(output, _build(self))
+    def test_slots(self):
+        """Test rsk_fsm.target.pythonc.Builder instances are weakly
+        referenceable and final until initialised
+        """
+        output = _build(self)
+        self.assertIn(
+            '\t.tp_weaklistoffset = offsetof(fsm_object_t, weakreflist),\n'
+            '\t.tp_new = fsm_new,\n',
+            output,
+        )
+        self.assertIn(
+            '\tself->fsm.state = INVALID_STATE;\n'
+            '\tself->cb.condition_check = ignore_condition;\n',
+            output,
+        )
+    def test_write_files(self):
+        """Test rsk_fsm.target.pythonc.Builder writes share/test.fsm files"""
+        files = _write_files(self)
+        self.assertEqual(sorted(files), [
+            'test_fsm.c', 'test_fsm.h', 'test_fsm_module.c',
+        ])
+        self.assertTrue(files['test_fsm_module.c'].startswith(
+            '#define PY_SSIZE_T_CLEAN\n#include <Python.h>\n'
+            '#include <structmember.h>\n#include "test_fsm.h"\n\n'
+        ))
+
+class TestTargetIRBuilder(TestCase):
+    """Test cases for rsk_fsm.target.ir.Builder"""
+    @staticmethod
+    def get_builder(prefix):
+        """Return the builder to test"""
+        return IRBuilder(prefix)
+    def test_build(self):
+        """Test rsk_fsm.target.ir.Builder builds share/test.fsm"""
+        ir = json.loads(_build(self))
+        self.assertEqual(ir['rsk-fsm-ir'], 1)
+        self.assertEqual(ir['name'], 'test')
+        self.assertEqual(ir['initial'], '/A/B')
+        self.assertEqual(ir['events'], ['X', 'Y', 'Z'])
+        self.assertIn(['/A/B', '/A', '/A/B'], ir['states'])
+        self.assertEqual(
+            sorted(ir['transitions']['X']), ['/A/B', '/A/C', '/D/E', '/D/F'],
+        )
+        # building IR from IR reproduces it
+        self.assertEqual(_build_ir(self), (_build(self),) * 2)
+    def test_write_files(self):
+        """Test rsk_fsm.target.ir.Builder writes share/test.fsm files"""
+        self.assertEqual(_write_files(self), {
+            'test_fsm.ir': _build(self) + '\n',
+        })
@@ -4,7 +4,7 @@
 
 from unittest import TestCase
 
-from rsk_fsm.build import (Fsm, State, Transition, Builder)
+from rsk_fsm.build import (Fsm, State, Transition, Builder, fork_map)
 
 # pylint: disable=no-member
 
@@ -201,6 +201,19 @@ class TestTransition(TestCase):
         mock = MockTransition({'next': None})
         self.assertEqual(None, mock.next_state)
 
+class TestForkMap(TestCase):
+    """Test cases for rsk_fsm.build.fork_map"""
+    def test_serial(self):
+        """Test rsk_fsm.build.fork_map maps in this process"""
+        self.assertEqual(list(fork_map(lambda x: x * x, range(5), 1)), [
+            0, 1, 4, 9, 16,
+        ])
+    def test_jobs(self):
+        """Test rsk_fsm.build.fork_map maps in order in worker processes"""
+        self.assertEqual(list(fork_map(lambda x: x * x, range(50), 3)), [
+            x * x for x in range(50)
+        ])
+
 class TestBuilder(TestCase):
     """Test cases for rsk_fsm.build.Builder"""
     def __init__(self, *args):
@@ -295,6 +308,100 @@ class TestBuilder(TestCase):
         with self.assertRaises(ValueError):
             builder.build(fsm)
 
+    def test_builder_ancestors(self):
+        """Test rsk_fsm.build.Builder.build records state ancestor chains"""
+        class AncestorsBuilder(Builder):
+            """A builder returning the state ancestor chains"""
+            def build_implementation(self):
+                return dict(self.ancestors)
+        fsm = MockFsm({
+            'initial': 'A',
+            'states': [
+                MockState({
+                    'state': 'A',
+                    'initial': 'B',
+                    'states': [
+                        MockState({
+                            'state': 'B',
+                            'initial': 'C',
+                            'states': [MockState({'state': 'C'})],
+                        }),
+                    ],
+                }),
+                MockState({'state': 'D'}),
+            ],
+        })
+        self.assertEqual(AncestorsBuilder('anc').build(fsm), {
+            '/A': ('/A',),
+            '/A/B': ('/A/B', '/A'),
+            '/A/B/C': ('/A/B/C', '/A/B', '/A'),
+            '/D': ('/D',),
+        })
+    def test_builder_reuse(self):
+        """Test rsk_fsm.build.Builder.build clears cached state nodes"""
+        first = MockFsm({
+            'initial': 'A',
+            'states': [
+                MockState({
+                    'state': 'A',
+                    'initial': 'B',
+                    'states': [MockState({'state': 'B'})],
+                }),
+            ],
+        })
+        second = MockFsm({
+            'initial': 'A',
+            'states': [MockState({'state': 'A'})],
+        })
+        builder = _TargetBuilder('reuse')
+        self.assertEqual(builder.build(first)['initial'], '/A/B')
+        self.assertEqual(builder.build(second)['initial'], '/A')
+    def test_builder_ir(self):
+        """Test rsk_fsm.build.Builder.build_ir builds as from the FSM"""
+        class IRBuilder(Builder):
+            """A builder returning the intermediate representation"""
+            def build_implementation(self):
+                return self.get_ir()
+        fsm = MockFsm({
+            'initial': 'A',
+            'states': [
+                MockState({
+                    'state': 'A',
+                    'initial': 'B',
+                    'states': [
+                        MockState({
+                            'state': 'B',
+                            'transitions': [
+                                MockTransition({'event': 'X', 'next': '/C'}),
+                            ],
+                        }),
+                    ],
+                }),
+                MockState({'state': 'C'}),
+            ],
+        })
+        ir = IRBuilder('ir').build(fsm)
+        self.assertEqual(ir['states'], [
+            ['/A', None, '/A/B'],
+            ['/A/B', '/A', '/A/B'],
+            ['/C', None, '/C'],
+        ])
+        builder = _TargetBuilder('ir')
+        built = builder.build(fsm)
+        self.assertEqual(builder.build_ir(ir), built)
+        for bad in (
+                {},
+                dict(ir, **{'rsk-fsm-ir': 0}),
+                {_: ir[_] for _ in ir if _ != 'transitions'},
+                dict(ir, states=[ir['states'][1], ir['states'][0]]),
+                dict(ir, states=[['/A', None, '/A/D']] + ir['states'][1:]),
+                dict(ir, initial='/D'),
+                dict(ir, transitions={'Y': {}}),
+                dict(ir, transitions={'X': {'/D': []}}),
+            ):
+            with self.assertRaises(ValueError):
+                builder.build_ir(bad)
+
 class _TargetBuilder(Builder):
     """A builder of target implementations comparable with test expectations"""
     def build_implementation(self):
@@ -0,0 +1,65 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Test cases for rsk_fsm.cache"""
+
+import os
+
+from tempfile import TemporaryDirectory
+from unittest import TestCase
+
+from rsk_fsm.cache import (Cache, source_digest)
+
+class TestCache(TestCase):
+    """Test cases for rsk_fsm.cache.Cache"""
+    def test_source_digest(self):
+        """Test rsk_fsm.cache.source_digest is stable"""
+        self.assertEqual(source_digest(), source_digest())
+        self.assertEqual(len(source_digest()), 64)
+    def test_key(self):
+        """Test rsk_fsm.cache.Cache.key depends on every input"""
+        key = Cache.key(spec='{}', target='C', options={'queue': 0})
+        self.assertEqual(
+            key,
+            Cache.key(options={'queue': 0}, target='C', spec='{}'),
+        )
+        self.assertNotEqual(
+            key,
+            Cache.key(spec='{}', target='C', options={'queue': 1}),
+        )
+        self.assertNotEqual(
+            key,
+            Cache.key(spec='{}', target='Python', options={'queue': 0}),
+        )
+    def test_get_put(self):
+        """Test rsk_fsm.cache.Cache stores and returns entries"""
+        with TemporaryDirectory() as directory:
+            cache = Cache(directory)
+            key = cache.key(spec='{}')
+            self.assertIsNone(cache.get(key))
+            entry = {'foo.h': 'header\n', 'foo.c': 'source\n'}
+            self.assertIsNone(cache.put(key, entry))
+            self.assertEqual(cache.get(key), entry)
+            self.assertIsNone(cache.get(cache.key(spec='[]')))
+    def test_get_put_code(self):
+        """Test rsk_fsm.cache.Cache stores and returns marshalled objects"""
+        with TemporaryDirectory() as directory:
+            cache = Cache(directory)
+            key = cache.key(spec='{}')
+            self.assertIsNone(cache.get_code(key))
+            code = compile('x = 1', '<test>', 'exec')
+            self.assertIsNone(cache.put_code(key, ('test', code)))
+            self.assertEqual(cache.get_code(key), ('test', code))
+            # entries and marshalled objects do not collide
+            self.assertIsNone(cache.get(key))
+    def test_get_corrupt(self):
+        """Test rsk_fsm.cache.Cache ignores a corrupt entry"""
+        with TemporaryDirectory() as directory:
+            cache = Cache(directory)
+            key = cache.key(spec='{}')
+            cache.put(key, {'-': 'output\n'})
+            (subdir,) = os.listdir(directory)
+            (name,) = os.listdir(os.path.join(directory, subdir))
+            path = os.path.join(directory, subdir, name)
+            with open(path, 'w', encoding='utf-8') as fid:
+                fid.write('{"truncated')
+            self.assertIsNone(cache.get(key))
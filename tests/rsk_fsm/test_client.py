@@ -0,0 +1,154 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Test cases for rsk_fsm.client and the rsk_fsm.compile server"""
+
+import json
+import os
+
+from tempfile import TemporaryDirectory
+from threading import Thread
+from unittest import TestCase
+from unittest.mock import patch
+
+from rsk_fsm import compile as fsm_compile
+from rsk_fsm.client import request
+from rsk_fsm.compile import make_server
+
+PACKAGE_DIR = os.path.abspath(
+    os.path.join(
+        os.path.dirname(__file__),
+        '../..',
+    )
+)
+TEST_FSM = os.path.join(PACKAGE_DIR, 'share/test.fsm')
+TEST_OUT_C = os.path.join(PACKAGE_DIR, 'share/test_fsm.out')
+
+class TestClient(TestCase):
+    """Test cases for rsk_fsm.client.request"""
+    def setUp(self):
+        # pylint: disable-next=consider-using-with
+        self._directory = TemporaryDirectory()
+        self._path = os.path.join(self._directory.name, 'rsk-fsm.sock')
+        self._server = make_server(self._path)
+        self._thread = Thread(target=self._server.serve_forever)
+        self._thread.start()
+    def tearDown(self):
+        self._server.shutdown()
+        self._thread.join()
+        self._server.server_close()
+        self._directory.cleanup()
+    def test_compile(self):
+        """Test rsk_fsm.client.request compiles share/test.fsm"""
+        response = request(self._path, [TEST_FSM, 'C'])
+        with open(TEST_OUT_C, encoding='utf-8') as fid:
+            output = fid.read().rstrip() + '\n'
+        self.assertEqual(response, {
+            'status': 0,
+            'stdout': output,
+            'stderr': '',
+        })
+        # the server remains available for further requests
+        self.assertEqual(request(self._path, [TEST_FSM, 'C']), response)
+    def test_error(self):
+        """Test rsk_fsm.client.request returns compile errors"""
+        response = request(self._path, [TEST_FSM])
+        self.assertEqual(response['status'], 2)
+        self.assertEqual(response['stdout'], '')
+        self.assertIn('required: target', response['stderr'])
+        response = request(self._path, ['-', 'C'])
+        self.assertEqual(response['status'], 2)
+        self.assertIn("cannot read '-'", response['stderr'])
+    def test_option_error(self):
+        """Test rsk_fsm.client.request returns option errors, not tracebacks"""
+        for (argv, message) in (
+                (['--queue', '-1'], '--queue must not be negative'),
+                (['--mailbox', '3'], '--mailbox must be a power of 2'),
+                (['--atomic', '--queue', '4'], '--atomic cannot be combined'),
+            ):
+            response = request(self._path, argv + [TEST_FSM, 'C'])
+            self.assertEqual(response['status'], 2)
+            self.assertIn(message, response['stderr'])
+        response = request(self._path, ['--vectorise', TEST_FSM, 'Python'])
+        self.assertEqual(response['status'], 1)
+        self.assertIn('cannot have conditions or actions', response['stderr'])
+        self.assertNotIn('Traceback', response['stderr'])
+    def test_duplicate_output(self):
+        """Test rsk_fsm.client.request refuses FSMs with the same outputs"""
+        with TemporaryDirectory() as directory:
+            copy = os.path.join(directory, 'copy.fsm')
+            with open(TEST_FSM, encoding='utf-8') as fid:
+                with open(copy, 'w', encoding='utf-8') as out:
+                    out.write(fid.read())
+            response = request(self._path, [
+                '--output-dir', directory, TEST_FSM, copy, 'C',
+            ])
+            self.assertEqual(response['status'], 1)
+            self.assertIn(
+                f'{copy}: FSM test would overwrite the output of {TEST_FSM}',
+                response['stderr'],
+            )
+            self.assertEqual(os.listdir(directory), ['copy.fsm'])
+    def test_bad_ir(self):
+        """Test rsk_fsm.client.request reports a malformed IR as an error"""
+        with TemporaryDirectory() as directory:
+            response = request(self._path, [
+                '--output-dir', directory, TEST_FSM, 'IR',
+            ])
+            self.assertEqual(response['status'], 0)
+            path = os.path.join(directory, 'test_fsm.ir')
+            with open(path, encoding='utf-8') as fid:
+                ir = json.load(fid)
+            ir['states'].reverse()
+            with open(path, 'w', encoding='utf-8') as fid:
+                json.dump(ir, fid)
+            response = request(self._path, [path, 'C'])
+            self.assertEqual(response['status'], 1)
+            self.assertIn(f'{path}: state ', response['stderr'])
+            self.assertIn(' precedes its parent ', response['stderr'])
+            self.assertNotIn('Traceback', response['stderr'])
+            # a truncated IR is not valid JSON
+            with open(path, 'w', encoding='utf-8') as fid:
+                fid.write('{"rsk-fsm-ir": 1, bad')
+            response = request(self._path, [path, 'C'])
+            self.assertEqual(response['status'], 1)
+            self.assertIn(
+                f'{path}: Expecting property name', response['stderr'],
+            )
+            self.assertNotIn('Traceback', response['stderr'])
+    def test_cwd(self):
+        """Test rsk_fsm.client.request restores the server working directory"""
+        cwd = os.getcwd()
+        with TemporaryDirectory() as directory:
+            response = request(self._path, [
+                '--output-dir', '.', TEST_FSM, 'C',
+            ], cwd=directory)
+            self.assertEqual(response['status'], 0)
+            self.assertEqual(
+                sorted(os.listdir(directory)), ['test_fsm.c', 'test_fsm.h'],
+            )
+        self.assertEqual(os.getcwd(), cwd)
+    def test_schema_edited(self):
+        """Test rsk_fsm.client.request reloads a schema edited between requests
+        """
+        load = fsm_compile.RootSchema.load
+        with TemporaryDirectory() as directory:
+            schema = os.path.join(directory, 'schema.json')
+            with open(schema, 'w', encoding='utf-8') as fid:
+                fid.write('{}')
+            argv = ['--schema', schema, TEST_FSM, 'C']
+            # the schema file is only digested: load the installed schema
+            with patch.object(
+                    fsm_compile.RootSchema, 'load',
+                    side_effect=lambda path, support: load(
+                        fsm_compile.SCHEMA_FILE, support=support,
+                    ),
+                ) as loaded:
+                response = request(self._path, argv)
+                self.assertEqual(response['status'], 0)
+                self.assertEqual(request(self._path, argv), response)
+                loaded.assert_called_once()
+                with open(schema, 'w', encoding='utf-8') as fid:
+                    fid.write('{"type": "object"}')
+                os.utime(schema, ns=(0, 0))
+                self.assertEqual(request(self._path, argv), response)
+                self.assertEqual(loaded.call_count, 2)
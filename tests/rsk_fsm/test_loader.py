@@ -0,0 +1,125 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Test cases for rsk_fsm.loader"""
+
+import marshal
+import os
+
+from tempfile import TemporaryDirectory
+from unittest import TestCase
+from unittest.mock import patch
+
+import rsk_fsm
+from rsk_fsm import (compile as fsm_compile, loader)
+
+PACKAGE_DIR = os.path.abspath(
+    os.path.join(
+        os.path.dirname(__file__),
+        '../..',
+    )
+)
+TEST_FSM = os.path.join(PACKAGE_DIR, 'share/test.fsm')
+
+class _Callbacks(): # pylint: disable=too-few-public-methods
+    """Callbacks recording each call"""
+    def __init__(self):
+        self.trace = []
+    def __getattr__(self, name):
+        def callback(fsm, arg):
+            self.trace.append((name, fsm.state, arg))
+            return name.startswith('condition_')
+        return callback
+
+class TestLoader(TestCase):
+    """Test cases for rsk_fsm.load"""
+    def setUp(self):
+        with open(TEST_FSM, encoding='utf-8') as fid:
+            self.spec = fid.read()
+        # pylint: disable=protected-access
+        patcher = patch.dict(loader._CODE, clear=True)
+        patcher.start()
+        self.addCleanup(patcher.stop)
+    def test_load(self):
+        """Test rsk_fsm.load returns a new module, built once"""
+        module = rsk_fsm.load(self.spec)
+        self.assertEqual(module.__name__, 'test_fsm')
+        callbacks = _Callbacks()
+        fsm = module.Fsm(callbacks)
+        fsm.inject_X(1)
+        fsm.inject_Z(2)
+        self.assertEqual(fsm.state, module.STATE_D_E)
+        self.assertEqual(callbacks.trace[0], ('action_enter_A', 0, None))
+        with patch.object(loader, '_compile') as build:
+            again = rsk_fsm.load(self.spec)
+        build.assert_not_called()
+        self.assertIsNot(again, module)
+        self.assertIs(
+            again.handle_X_in_A_B.__code__,
+            module.handle_X_in_A_B.__code__,
+        )
+        self.assertEqual(
+            rsk_fsm.load(self.spec, prefix='other').__name__,
+            'other_fsm',
+        )
+    def test_options(self):
+        """Test rsk_fsm.load builds with Python target options"""
+        module = rsk_fsm.load(self.spec, asyncio=True)
+        self.assertTrue(hasattr(module.Fsm, 'process'))
+        self.assertFalse(hasattr(rsk_fsm.load(self.spec).Fsm, 'process'))
+    def test_invalid(self):
+        """Test rsk_fsm.load raises CompileError for JSON text not valid"""
+        for spec in ('{"rsk-fsm-ir": 1, bad', self.spec[:-2]):
+            with self.assertRaises(fsm_compile.CompileError):
+                rsk_fsm.load(spec)
+    def test_cache_dir(self):
+        """Test rsk_fsm.load reuses bytecode cached in a directory"""
+        with TemporaryDirectory() as directory:
+            module = rsk_fsm.load(self.spec, cache_dir=directory)
+            loader._CODE.clear() # pylint: disable=protected-access
+            with patch.object(loader, '_compile') as build:
+                again = rsk_fsm.load(self.spec, cache_dir=directory)
+            build.assert_not_called()
+            self.assertEqual(
+                again.TRANSITION_ON_EVENT_X.index(again.handle_X_in_A_B),
+                module.TRANSITION_ON_EVENT_X.index(module.handle_X_in_A_B),
+            )
+    def test_cache_dir_corrupt(self):
+        """Test rsk_fsm.load rebuilds bytecode cached in a foreign format"""
+        with TemporaryDirectory() as directory:
+            rsk_fsm.load(self.spec, cache_dir=directory)
+            loader._CODE.clear() # pylint: disable=protected-access
+            (path,) = [
+                os.path.join(root, name)
+                for (root, _, names) in os.walk(directory)
+                for name in names if name.endswith('.marshal')
+            ]
+            for data in (
+                    marshal.dumps(('test_fsm', 'not code', 'extra')),
+                    marshal.dumps(['test_fsm', 'not code']),
+                    marshal.dumps(None),
+                ):
+                with open(path, 'wb') as fid:
+                    fid.write(data)
+                module = rsk_fsm.load(self.spec, cache_dir=directory)
+                loader._CODE.clear() # pylint: disable=protected-access
+                self.assertEqual(module.__name__, 'test_fsm')
+                # the rebuilt bytecode replaces the cache file
+                with open(path, 'rb') as fid:
+                    self.assertEqual(marshal.load(fid)[0], 'test_fsm')
+    def test_schema_digest(self):
+        """Test rsk_fsm.compile.schema_digest rehashes only a changed schema"""
+        with TemporaryDirectory() as directory:
+            schema = os.path.join(directory, 'schema.json')
+            with open(schema, 'w', encoding='utf-8') as fid:
+                fid.write('{}')
+            digest = fsm_compile.schema_digest(schema)
+            with patch('builtins.open') as opened:
+                self.assertEqual(fsm_compile.schema_digest(schema), digest)
+            opened.assert_not_called()
+            with open(schema, 'w', encoding='utf-8') as fid:
+                fid.write('{"type": "object"}')
+            os.utime(schema, ns=(0, 0))
+            self.assertNotEqual(fsm_compile.schema_digest(schema), digest)
+            self.assertIsNone(
+                fsm_compile.schema_digest(os.path.join(directory, 'missing')),
+            )
@@ -0,0 +1,81 @@
+### SPDX-License-Identifier: GPL-2.0-or-later
+
+"""Test cases for rsk_fsm.report"""
+
+import struct
+
+from io import StringIO
+from unittest import TestCase
+
+from rsk_fsm.build import (Fsm, State, Transition, Builder)
+from rsk_fsm.report import (Report, phase)
+
+# pylint: disable=no-member
+
+MockFsm = type('MockFsm', (dict, Fsm), {})
+MockState = type('MockState', (dict, State), {})
+MockTransition = type('MockTransition', (dict, Transition), {})
+
+class _IRBuilder(Builder):
+    """A builder returning the intermediate representation"""
+    def build_implementation(self):
+        return self.get_ir()
+
+class TestReport(TestCase):
+    """Test cases for rsk_fsm.report.Report"""
+    def test_phase(self):
+        """Test rsk_fsm.report.phase records phases"""
+        report = Report('test')
+        with phase(report, 'first'):
+            pass
+        with phase(None, 'ignored'):
+            pass
+        self.assertEqual([_[0] for _ in report.phases], ['first'])
+        fid = StringIO()
+        report.write(fid)
+        self.assertTrue(fid.getvalue().startswith('test:\n'))
+        self.assertIn('\n  first ', fid.getvalue())
+    def test_build(self):
+        """Test rsk_fsm.report.Report records build phases and statistics"""
+        fsm = MockFsm({
+            'initial': 'A',
+            'states': [
+                MockState({
+                    'state': 'A',
+                    'initial': 'B',
+                    'states': [
+                        MockState({
+                            'state': 'B',
+                            'transitions': [
+                                MockTransition({'event': 'X', 'next': '/C'}),
+                            ],
+                        }),
+                    ],
+                }),
+                MockState({
+                    'state': 'C',
+                    'transitions': [
+                        MockTransition({'event': 'X', 'next': '/A'}),
+                        MockTransition({'event': 'Y', 'next': False}),
+                    ],
+                }),
+            ],
+        })
+        report = Report('test')
+        ir = _IRBuilder('test', report=report).build(fsm)
+        report.write(StringIO())
+        self.assertEqual(ir, _IRBuilder('test').build(fsm))
+        self.assertEqual([_[0] for _ in report.phases], [
+            'walk', 'check states', 'check transitions', 'flatten', 'emit',
+        ])
+        self.assertEqual(dict(report.stats), {
+            'states': 3,
+            'events': 2,
+            'conditions': 0,
+            'actions': 0,
+            'handlers': 3,
+            'unique handler bodies': 3,
+            'handler table bytes': 6 * struct.calcsize('P'),
+            # exit /A/B, /A; enter /C
+            'longest exit/enter chain': 3,
+        })